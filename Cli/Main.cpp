@@ -0,0 +1,13 @@
+#ifdef _WIN32
+#include <Windows.h>
+
+extern "C" __declspec(dllimport) int RunCommandLine(int argc, const char* const* argv);
+#else
+// Linked statically with the sources of the plugin
+extern "C" int RunCommandLine(int argc, const char* const* argv);
+#endif
+
+// Console runner of the plugin library for headless runs and benchmarks, see RunCommandLine
+int main(int argc, char* argv[]) {
+	return RunCommandLine(argc - 1, argv + 1);
+}
\ No newline at end of file
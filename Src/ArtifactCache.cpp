@@ -0,0 +1,110 @@
+#include "pch.h"
+
+#include "ArtifactCache.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+ArtifactCache::ArtifactCache(const std::string& directory, size_t limit) : directory_(directory), limit_(limit) {
+	std::filesystem::create_directories(directory_);
+}
+
+std::string ArtifactCache::makeKey(const std::string& terrain, const std::string& options) {
+	std::ostringstream source;
+	source << std::filesystem::absolute(terrain).string() << "|" << std::filesystem::file_size(terrain) << "|" << std::filesystem::last_write_time(terrain).time_since_epoch().count() << "|" << options;
+
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+
+	for (char c : source.str()) {
+		hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+	}
+
+	std::ostringstream key;
+	key << std::hex << std::setfill('0') << std::setw(16) << hash;
+
+	return key.str();
+}
+
+bool ArtifactCache::contains(const std::string& key) {
+	std::filesystem::path entry = directory_ / key;
+
+	if (!std::filesystem::is_directory(entry)) {
+		return false;
+	}
+
+	std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now());
+
+	return true;
+}
+
+std::filesystem::path ArtifactCache::getPath(const std::string& key, const std::string& name) {
+	return directory_ / key / name;
+}
+
+std::filesystem::path ArtifactCache::begin(const std::string& key) {
+	std::filesystem::path staging = directory_ / (key + ".partial");
+
+	std::filesystem::remove_all(staging);
+	std::filesystem::create_directories(staging);
+
+	return staging;
+}
+
+void ArtifactCache::commit(const std::string& key) {
+	std::filesystem::path entry = directory_ / key;
+
+	std::filesystem::remove_all(entry);
+	std::filesystem::rename(directory_ / (key + ".partial"), entry);
+
+	evict(key);
+}
+
+void ArtifactCache::evict(const std::string& keep) {
+	struct Entry {
+		std::filesystem::path path;
+		std::filesystem::file_time_type used;
+		size_t size;
+	};
+
+	std::vector<Entry> entries;
+	size_t total = 0;
+
+	for (auto& item : std::filesystem::directory_iterator(directory_)) {
+		if (!item.is_directory() || item.path().extension() == ".partial") {
+			continue;
+		}
+
+		size_t size = 0;
+
+		for (auto& file : std::filesystem::recursive_directory_iterator(item.path())) {
+			if (file.is_regular_file()) {
+				size += size_t(file.file_size());
+			}
+		}
+
+		entries.push_back({ item.path(), item.last_write_time(), size });
+		total += size;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return a.used < b.used;
+		});
+
+	for (auto& entry : entries) {
+		if (total <= limit_) {
+			break;
+		}
+
+		if (entry.path.filename() == keep) {
+			continue;
+		}
+
+		std::filesystem::remove_all(entry.path);
+		total -= entry.size;
+
+		std::cout << "Artifact cache: evicted " << entry.path.filename().string() << " (" << entry.size / (1024 * 1024) << "MB)" << std::endl;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// Intermediate rasters kept between runs in a directory, one subdirectory per entry named by the key. The key hashes
+// the terrain file (path, size, modification time) and the options the artifacts depend on. An entry is written to a
+// staging directory and renamed once complete, least recently used entries are evicted while the cache exceeds its limit.
+class ArtifactCache {
+public:
+	ArtifactCache(const std::string& directory, size_t limit);
+
+	static std::string makeKey(const std::string& terrain, const std::string& options);
+
+	// Marks a complete entry as used
+	bool contains(const std::string& key);
+
+	// File of a complete entry
+	std::filesystem::path getPath(const std::string& key, const std::string& name);
+
+	// Creates an empty staging directory of the entry and returns it
+	std::filesystem::path begin(const std::string& key);
+	void commit(const std::string& key);
+
+private:
+	void evict(const std::string& keep);
+
+	std::filesystem::path directory_;
+	size_t limit_ = 0;
+};
\ No newline at end of file
@@ -4,12 +4,15 @@
 #include <condition_variable>
 #include <functional>
 
+#include "Statistics.h"
+
 class Barrier {
 public:
 	Barrier() = default;
 	
 	template<typename _Predicate>
 	void wait(int threadsCount, _Predicate pred) {
+		auto start = std::chrono::steady_clock::now();
 		std::unique_lock lock(mutex_);
 
 		if (threadsCount_ == 0) {
@@ -21,19 +24,30 @@ public:
 
 		cv_.wait(lock, [this] { return !threadsCount_.load(std::memory_order_relaxed) || pred_(); });
 		cv_.notify_all();
+
+		Statistics::getInstance().addWait(WaitPoint::Barrier, std::chrono::steady_clock::now() - start);
 	}
 
+	// Reusable right away, a thread passing it again doesn't hold back the ones still waking up
 	void wait(int threadsCount) {
+		auto start = std::chrono::steady_clock::now();
 		std::unique_lock lock(mutex_);
 
 		if (!threadsCount_) {
 			threadsCount_ = threadsCount;
 		}
 
-		threadsCount_--;
+		size_t generation = generation_;
 
-		cv_.wait(lock, [this] { return !threadsCount_.load(std::memory_order_relaxed); });
-		cv_.notify_all();
+		if (!--threadsCount_) {
+			generation_++;
+			cv_.notify_all();
+		}
+		else {
+			cv_.wait(lock, [this, generation] { return generation_ != generation; });
+		}
+
+		Statistics::getInstance().addWait(WaitPoint::Barrier, std::chrono::steady_clock::now() - start);
 	}
 
 private:
@@ -41,4 +55,5 @@ private:
 	std::condition_variable cv_;
 	std::atomic_int threadsCount_ = 0;
 	std::function<bool()> pred_;
+	size_t generation_ = 0;
 };
\ No newline at end of file
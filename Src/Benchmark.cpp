@@ -0,0 +1,225 @@
+#include "pch.h"
+
+#include "Benchmark.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "GdalTiffReader.h"
+
+Benchmark::Benchmark(const BenchmarkOptions& options) : options_(options) {
+	if (options_.directory.empty() || options_.kinds.empty() || options_.sizes.empty() || options_.threads.empty() || options_.repeats <= 0) {
+		throw std::runtime_error("Benchmark: Invalid options!");
+	}
+}
+
+int Benchmark::run() {
+	std::filesystem::path directory = options_.directory;
+	std::filesystem::create_directories(directory);
+
+	std::ofstream report;
+
+	if (!options_.report.empty()) {
+		report.open(options_.report, std::ios::trunc);
+
+		if (!report) {
+			throw std::runtime_error("Benchmark: Failed to open " + options_.report + "!");
+		}
+	}
+
+	int failures = 0;
+
+	for (TerrainKind kind : options_.kinds) {
+		for (int size : options_.sizes) {
+			TerrainGenerator generator(kind, size, size);
+
+			std::string name = std::string(TerrainGenerator::getKindName(kind)) + "_" + std::to_string(size);
+			std::filesystem::path terrain = directory / (name + ".tif");
+			std::filesystem::path output = directory / (name + "_accumulation.tif");
+
+			try {
+				generator.generate(terrain.string());
+			}
+			catch (const std::exception& exception) {
+				std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+				std::cout << "Benchmark: failed to generate " << name << std::endl;
+
+				failures++;
+
+				continue;
+			}
+
+			Plugin::getInstance().setConditioning(generator.needsFilling() ? Conditioning::FillDepressions : Conditioning::None);
+
+			for (int threads : options_.threads) {
+				for (int repeat = 0; repeat < options_.repeats; repeat++) {
+					try {
+						Plugin::getInstance().process(terrain.string(), output.string(), threads);
+					}
+					catch (const std::exception& exception) {
+						std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+					}
+
+					const RunReport& result = Plugin::getInstance().getReport();
+					std::string line = formatReport(name, threads, result);
+
+					if (!result.succeeded) {
+						failures++;
+					}
+
+					if (report.is_open()) {
+						report << line << std::endl;
+					}
+
+					std::cout << "Benchmark: " << line << std::endl;
+				}
+			}
+
+			if (options_.verify) {
+				try {
+					failures += verify(terrain, name, generator.needsFilling());
+				}
+				catch (const std::exception& exception) {
+					std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+					failures++;
+				}
+			}
+
+			// A file left behind doesn't fail the case
+			std::error_code error;
+
+			std::filesystem::remove(terrain, error);
+			std::filesystem::remove(output, error);
+		}
+	}
+
+	Plugin::getInstance().setConditioning(Conditioning::None);
+
+	return failures;
+}
+
+int Benchmark::verify(const std::filesystem::path& terrain, const std::string& name, bool filled) {
+	static const std::pair<AccumulationMode, const char*> MODES[] = { { AccumulationMode::Paths, "paths" }, { AccumulationMode::Tiled, "tiled" } };
+
+	Plugin& plugin = Plugin::getInstance();
+	AccumulationMode mode = plugin.getAccumulationMode();
+
+	std::vector<std::filesystem::path> outputs;
+	std::vector<std::string> names;
+	int failures = 0;
+
+	for (auto& [accumulationMode, modeName] : MODES) {
+		outputs.push_back(terrain.parent_path() / (name + "_" + modeName + ".tif"));
+		names.push_back(modeName);
+
+		plugin.setAccumulationMode(accumulationMode);
+
+		try {
+			plugin.process(terrain.string(), outputs.back().string(), options_.threads.back());
+		}
+		catch (const std::exception& exception) {
+			std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+		}
+
+		if (!plugin.getReport().succeeded) {
+			outputs.back().clear();
+		}
+	}
+
+	plugin.setAccumulationMode(mode);
+
+	// Workers are processes of this runner, the job is merged in the same places as the tiled mode
+	if (options_.workers > 0 && !filled) {
+		std::filesystem::path jobDirectory = terrain.parent_path() / (name + "_job");
+
+		outputs.push_back(terrain.parent_path() / (name + "_job.tif"));
+		names.push_back("job of " + std::to_string(options_.workers) + " workers");
+
+		try {
+			plugin.runJob(terrain.string(), outputs.back().string(), jobDirectory.string(), options_.workers, max(options_.threads.back() / options_.workers, 1));
+		}
+		catch (const std::exception& exception) {
+			std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+			outputs.back().clear();
+		}
+
+		std::error_code error;
+		std::filesystem::remove_all(jobDirectory, error);
+	}
+
+	// Row by row against the paths output
+	for (size_t i = 1; i < outputs.size(); i++) {
+		size_t mismatches = 0;
+
+		if (outputs[0].empty() || outputs[i].empty()) {
+			mismatches = ~size_t(0);
+		}
+		else {
+			GEOTIFF_READER expectedReader(new GdalTiffReader(outputs[0].string()));
+			GEOTIFF_READER actualReader(new GdalTiffReader(outputs[i].string()));
+
+			RASTER_BAND expected(expectedReader->getRasterBand(1));
+			RASTER_BAND actual(actualReader->getRasterBand(1));
+
+			int width = expected->getXSize(), height = expected->getYSize();
+			std::vector<uint32_t> expectedRow(width), actualRow(width);
+
+			for (int y = 0; y < height; y++) {
+				if (expected->rasterUInt32(0, y, width, 1, expectedRow.data(), width, 1) || actual->rasterUInt32(0, y, width, 1, actualRow.data(), width, 1)) {
+					throw std::runtime_error("Benchmark: Failed to read " + name + " outputs!");
+				}
+
+				for (int x = 0; x < width; x++) {
+					mismatches += expectedRow[x] != actualRow[x];
+				}
+			}
+		}
+
+		if (mismatches) {
+			failures++;
+		}
+
+		std::cout << "Benchmark: verify " << name << " " << names[i] << ": " << (mismatches == ~size_t(0) ? "failed to run" : std::to_string(mismatches) + " cells differ from paths") << std::endl;
+	}
+
+	std::error_code error;
+
+	for (auto& output : outputs) {
+		if (!output.empty()) {
+			std::filesystem::remove(output, error);
+		}
+	}
+
+	return failures;
+}
+
+std::string Benchmark::formatReport(const std::string& terrain, int threads, const RunReport& report) {
+	std::string escaped;
+
+	for (char c : terrain) {
+		if (c == '\\' || c == '"') {
+			escaped += '\\';
+		}
+
+		escaped += c;
+	}
+
+	std::ostringstream line;
+	line << "{\"terrain\":\"" << escaped << "\",\"width\":" << report.width << ",\"height\":" << report.height << ",\"threads\":" << threads;
+	line << ",\"succeeded\":" << (report.succeeded ? "true" : "false") << ",\"cached\":" << (report.cached ? "true" : "false");
+	line << ",\"peakWorkingSet\":" << report.peakWorkingSet << ",\"peakTempBytes\":" << report.peakTempBytes << ",\"phases\":[";
+
+	for (size_t i = 0; i < report.phases.size(); i++) {
+		const PhaseReport& phase = report.phases[i];
+		double cellsPerSecond = phase.seconds > 0 ? phase.cells / phase.seconds : 0;
+
+		line << (i ? "," : "") << "{\"name\":\"" << phase.name << "\",\"seconds\":" << phase.seconds << ",\"cells\":" << phase.cells << ",\"cellsPerSecond\":" << size_t(cellsPerSecond) << "}";
+	}
+
+	line << "]}";
+
+	return line.str();
+}
\ No newline at end of file
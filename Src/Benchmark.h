@@ -0,0 +1,37 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Plugin.h"
+#include "TerrainGenerator.h"
+
+struct BenchmarkOptions {
+	std::string directory; // Terrains and outputs
+	std::vector<TerrainKind> kinds = { TerrainKind::Plane, TerrainKind::Fractal, TerrainKind::Flats, TerrainKind::Coast, TerrainKind::Valley };
+	std::vector<int> sizes = { 1024, 4096 }; // Square terrains
+	std::vector<int> threads = { 1, 4 };
+	int repeats = 1;
+	std::string report; // JSON lines, printed only if empty
+	bool verify = false; // The tiled and job outputs must match the paths one, a mismatch counts as a failed run
+	int workers = 2; // Worker processes of the verified job, none if zero
+};
+
+// End-to-end runs of the whole process over synthetic terrains, one JSON line per run
+class Benchmark {
+public:
+	Benchmark(const BenchmarkOptions& options);
+
+	// Returns the number of failed runs
+	int run();
+
+	static std::string formatReport(const std::string& terrain, int threads, const RunReport& report);
+
+private:
+	// Runs every accumulation mode and a tile job over the terrain, returns the number of runs that disagree with the
+	// paths one. Jobs don't fill depressions, they are left out for terrains that need it.
+	int verify(const std::filesystem::path& terrain, const std::string& name, bool filled);
+
+	BenchmarkOptions options_;
+};
\ No newline at end of file
@@ -2,14 +2,27 @@
 
 #include "Canvas.h"
 
+#include <algorithm>
+#include <cstring>
+
 template<typename T>
 int Slot<T>::getIndex() {
-	return index_;
+	return index_.load(std::memory_order_acquire);
 }
 
 template<typename T>
 void Slot<T>::setIndex(int index) {
-	index_ = index;
+	index_.store(index, std::memory_order_release);
+}
+
+template<typename T>
+void Slot<T>::setWidth(int width) {
+	width_ = width;
+}
+
+template<typename T>
+int Slot<T>::getWidth() {
+	return width_;
 }
 
 template<typename T>
@@ -22,6 +35,16 @@ int Slot<T>::getHeight() {
 	return height_;
 }
 
+template<typename T>
+void Slot<T>::setOffsetX(int offsetX) {
+	offsetX_ = offsetX;
+}
+
+template<typename T>
+int Slot<T>::getOffsetX() {
+	return offsetX_;
+}
+
 template<typename T>
 void Slot<T>::setOffsetY(int offsetY) {
 	offsetY_ = offsetY;
@@ -38,122 +61,770 @@ Grid<T>& Slot<T>::getGrid() {
 }
 
 template<typename T>
-int& Slot<T>::getChangesCount() {
+std::atomic<int>& Slot<T>::getChangesCount() {
 	return changesCounter_;
 }
 
 template<typename T>
-Canvas<T>::Canvas(RASTER_BAND band, bool rareLocking, bool dumping) : band_(band), rareLocking_(rareLocking), dumping_(dumping) {
-	if (!tileWidth_) {
-		tileWidth_ = band->getXSize();
-		tileHeight_ = band->getYSize();
+void Slot<T>::setLastUse(size_t lastUse) {
+	lastUse_.store(lastUse, std::memory_order_relaxed);
+}
+
+template<typename T>
+size_t Slot<T>::getLastUse() {
+	return lastUse_.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+bool Slot<T>::tryPin(int index) {
+	if (pins_.fetch_add(1, std::memory_order_acquire) < 0) {
+		unpin();
+
+		return false;
+	}
+
+	// The slot could be reused for another tile after the lookup
+	if (getIndex() != index) {
+		unpin();
+
+		return false;
+	}
+
+	return true;
+}
+
+template<typename T>
+void Slot<T>::pin() {
+	pins_.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename T>
+void Slot<T>::unpin() {
+	pins_.fetch_sub(1, std::memory_order_release);
+}
+
+template<typename T>
+int Slot<T>::getPins() {
+	return pins_.load(std::memory_order_acquire);
+}
+
+template<typename T>
+bool Slot<T>::tryEvict() {
+	int expected = 0;
+
+	return pins_.compare_exchange_strong(expected, LOADING, std::memory_order_acquire);
+}
+
+template<typename T>
+void Slot<T>::publish() {
+	pins_.fetch_add(1 - LOADING, std::memory_order_release);
+}
+
+template<typename T>
+Canvas<T>::Canvas(RASTER_BAND band, bool dumping, MEMORY_BUDGET budget, int slotWidth, int slotHeight, bool minMax) : band_(band), dumping_(dumping), minMax_(minMax), budget_(budget) {
+	width_ = band->getXSize();
+	height_ = band->getYSize();
+
+	int blockWidth, blockHeight;
+	band->getBlockSize(&blockWidth, &blockHeight);
+
+	if (!slotWidth || !slotHeight) {
+		slotWidth = slotHeight = 1024;
+	}
+
+	// Whole blocks only, so none is decompressed for a part of it or rewritten by neighbouring slots.
+	// Strip blocks span the full width, keep the requested area by making such slots lower.
+	size_t area = size_t(slotWidth) * slotHeight;
+
+	slotWidth_ = min((slotWidth + blockWidth - 1) / blockWidth * blockWidth, width_);
+	slotHeight_ = int(max(area / slotWidth_, size_t(1)));
+	slotHeight_ = min((slotHeight_ + blockHeight - 1) / blockHeight * blockHeight, height_);
+
+	slotsPerRow_ = (width_ + slotWidth_ - 1) / slotWidth_;
+	slotsPerColumn_ = (height_ + slotHeight_ - 1) / slotHeight_;
+	slotSize_ = size_t(slotWidth_) * slotHeight_ * sizeof(T);
+
+	size_t tilesCount = size_t(slotsPerRow_) * slotsPerColumn_;
+
+	table_.reset(new std::atomic<Slot<T>*>[tilesCount]);
+	users_.reset(new std::atomic<User*>[USER_CHUNKS]);
+
+	for (size_t i = 0; i < tilesCount; i++) {
+		table_[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	for (int i = 0; i < USER_CHUNKS; i++) {
+		users_[i].store(nullptr, std::memory_order_relaxed);
 	}
 
-	step_ = (100 * 1024 * 1024) / (tileWidth_ * sizeof(T)); // 10MB
-	
-	//MEMORYSTATUSEX memory;
-	//GlobalMemoryStatusEx(&memory);
+	if (!budget_) {
+		budget_ = std::make_shared<MemoryBudget>(MemoryBudget::getAvailableMemory());
+	}
+
+	if (dumping_) {
+		flusher_ = std::thread(&Canvas<T>::flushProcess, this);
+	}
 
-	//slotLimit_ = (4ll * 1024 * 1024 * 1024 /*memory.ullAvailPhys * 0.8*/) / (tileWidth_ * sizeof(T) * step_);
+	statisticsId_ = Statistics::getInstance().attachCanvas([this] {
+			return getStatistics();
+		});
 }
 
 template<typename T>
 Canvas<T>::~Canvas() {
+	// Queued prefetches refer to the canvas
+	while (pendingPrefetches_.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+
 	if (dumping_) {
-		for (const auto slot : slots_) {
-			if (slot->getChangesCount()) {
-				band_->raster(0, slot->getOffsetY(), tileWidth_, slot->getHeight(), slot->getGrid().data(), tileWidth_, slot->getHeight());
-			}
+		bool written = true;
+
+		// Callers flush first to get the failure, a destructor can only report it
+		try {
+			flush();
+		}
+		catch (const std::exception& exception) {
+			std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+			written = false;
+		}
+
+		{
+			std::unique_lock lock(writesMtx_);
+
+			stopping_ = true;
 		}
 
-		band_->computeRasterMinMax(); // Should be optimized
+		writesCv_.notify_all();
+		flusher_.join();
+
+		budget_->release(spareGrids_.size() * slotSize_);
+
+		if (minMax_ && written) {
+			band_->computeRasterMinMax(); // Should be optimized
+		}
 	}
+
+	Statistics::getInstance().detachCanvas(statisticsId_);
+
+	for (int i = 0; i < USER_CHUNKS; i++) {
+		delete[] users_[i].load(std::memory_order_relaxed);
+	}
+
+	budget_->release(slots_.size() * slotSize_);
 }
 
 template<typename T>
 DataHolder<T> Canvas<T>::at(int x, int y, int index) {
-	int tileIndex = y / step_;
-	int offsetY = tileIndex * step_;
+	if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+		return DataHolder<T>(nullptr, nullptr);
+	}
+
+	int tileIndex = y / slotHeight_ * slotsPerRow_ + x / slotWidth_;
 
-	SLOT result;
-	SLOT freeSlot;
+	User& user = getUser(index);
+	Slot<T>* picked = user.slot;
 
-	auto& picked = users_[index];
+	if (!picked || picked->getIndex() != tileIndex) {
+		int previous = picked ? picked->getIndex() : -1;
+
+		if (picked) {
+			picked->unpin();
+		}
+
+		size_t hits = 0;
+		picked = user.slot = pin(tileIndex, hits);
+
+		if (hits) {
+			user.hits.fetch_add(hits, std::memory_order_relaxed);
+		}
 
-	std::unique_lock<Spinlock> lock;
+		// Walks and scans keep their direction for a while, the tiles further along it are loaded ahead
+		if (prefetcher_ && previous >= 0) {
+			int tileX = tileIndex % slotsPerRow_, tileY = tileIndex / slotsPerRow_;
+			int stepX = (tileX > previous % slotsPerRow_) - (tileX < previous % slotsPerRow_);
+			int stepY = (tileY > previous / slotsPerRow_) - (tileY < previous / slotsPerRow_);
 
-	if (!rareLocking_) {
-		lock = std::unique_lock(slotsMtx_);
+			for (int k = 1; k <= prefetcher_->getDepth(); k++) {
+				prefetchTile(tileX + stepX * k, tileY + stepY * k);
+			}
+		}
 	}
 
-	if (!picked || picked->getIndex() != tileIndex) {
-		if (rareLocking_) {
-			lock = std::unique_lock(slotsMtx_);
+	return DataHolder<T>(picked->getGrid().at(x - picked->getOffsetX(), y - picked->getOffsetY()), picked);
+}
+
+template<typename T>
+SlotView<T> Canvas<T>::view(int x, int y, bool writable) {
+	if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+		return SlotView<T>();
+	}
+
+	size_t hits = 0;
+	Slot<T>* slot = pin(y / slotHeight_ * slotsPerRow_ + x / slotWidth_, hits);
+
+	if (hits) {
+		viewHits_.fetch_add(hits, std::memory_order_relaxed);
+	}
+
+	if (writable) {
+		slot->getChangesCount().fetch_add(1);
+	}
+
+	return SlotView<T>(slot);
+}
+
+template<typename T>
+typename Canvas<T>::User& Canvas<T>::getUser(int index) {
+	// Non-negative indices and their complements interleave, so 0 and ~0 are different users
+	unsigned id = index >= 0 ? unsigned(index) * 2 : unsigned(~index) * 2 + 1;
+	unsigned chunk = id / USERS_PER_CHUNK;
+
+	if (chunk >= USER_CHUNKS) {
+		throw std::runtime_error("Canvas: Invalid user index!");
+	}
+
+	User* users = users_[chunk].load(std::memory_order_acquire);
+
+	if (!users) {
+		auto lock = Statistics::lock(slotsMtx_, WaitPoint::Slots);
+
+		users = users_[chunk].load(std::memory_order_acquire);
+
+		if (!users) {
+			users = new User[USERS_PER_CHUNK];
+			users_[chunk].store(users, std::memory_order_release);
 		}
+	}
 
-		for (auto& slot : slots_) {
-			if (slot->getIndex() == tileIndex) {
-				picked = result = slot;
+	return users[id % USERS_PER_CHUNK];
+}
 
-				break;
+template<typename T>
+Slot<T>* Canvas<T>::pin(int tileIndex, size_t& hits, bool prefetching) {
+	Slot<T>* slot = table_[tileIndex].load(std::memory_order_acquire);
+
+	if (slot && slot->tryPin(tileIndex)) {
+		size_t tick = tick_.load(std::memory_order_relaxed);
+
+		if (slot->getLastUse() != tick) {
+			slot->setLastUse(tick);
+		}
+
+		hits++;
+
+		return slot;
+	}
+
+	while (true) {
+		auto lock = Statistics::lock(slotsMtx_, WaitPoint::Slots);
+
+		// Could be loaded by another user while waiting for the lock
+		slot = table_[tileIndex].load(std::memory_order_acquire);
+
+		// The slot is published before it is loaded, the read runs without the lock and the others wait for it below
+		if (!slot) {
+			if (prefetching) {
+				statistics_.prefetches++;
+			}
+			else {
+				statistics_.misses++;
+			}
+
+			slot = acquire(tileIndex);
+
+			lock.unlock();
+
+			try {
+				if (!reclaim(slot)) {
+					load(slot);
+				}
+			}
+			catch (...) {
+				// The others waiting for the tile look it up again and load it themselves, the slot is left free
+				lock.lock();
+
+				table_[tileIndex].store(nullptr, std::memory_order_release);
+				slot->setIndex(-1);
+				slot->publish();
+				slot->unpin();
+
+				throw;
+			}
+
+			slot->publish();
+
+			return slot;
+		}
+
+		if (slot->tryPin(tileIndex)) {
+			if (!prefetching) {
+				statistics_.hits++;
+			}
+
+			return slot;
+		}
+
+		lock.unlock();
+
+		std::this_thread::yield();
+	}
+}
+
+template<typename T>
+Slot<T>* Canvas<T>::acquire(int tileIndex) {
+	Slot<T>* slot = nullptr;
+
+	size_t tick = tick_.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	// Keep slots cached while the budget allows
+	if (!budget_->acquire(slotSize_)) {
+		// Least recently used slot nobody holds, a pin taken after the scan makes the eviction fail
+		while (true) {
+			slot = nullptr;
+
+			for (auto& candidate : slots_) {
+				if (!candidate->getPins() && (!slot || candidate->getLastUse() < slot->getLastUse())) {
+					slot = candidate.get();
+				}
 			}
-			else if (!freeSlot && slot.use_count() == 1) {
-				freeSlot = slot;
+
+			if (!slot || slot->tryEvict()) {
+				break;
 			}
 		}
+
+		// Held slots can't be evicted so go over the budget if needed
+		if (!slot) {
+			budget_->acquire(slotSize_, true);
+		}
+	}
+
+	if (slot) {
+		statistics_.evictions++;
+
+		// Slots whose load failed hold no tile
+		if (slot->getIndex() >= 0) {
+			table_[slot->getIndex()].store(nullptr, std::memory_order_release);
+		}
+
+		if (dumping_ && slot->getChangesCount()) {
+			queueWrite(slot);
+			slot->getChangesCount() = 0;
+
+			statistics_.writeBacks++;
+		}
 	}
 	else {
-		result = picked;
+		slots_.push_back(std::make_unique<Slot<T>>());
+		slot = slots_.back().get();
 	}
 
-	if (!result) {
-		if (!freeSlot) {
-			freeSlot = std::make_shared<Slot<T>>();
-			slots_.push_back(freeSlot);
+	int slotX = tileIndex % slotsPerRow_;
+	int slotY = tileIndex / slotsPerRow_;
+
+	slot->setLastUse(tick);
+
+	slot->setOffsetX(slotX * slotWidth_);
+	slot->setOffsetY(slotY * slotHeight_);
+	slot->setWidth(min(width_ - slot->getOffsetX(), slotWidth_));
+	slot->setHeight(min(height_ - slot->getOffsetY(), slotHeight_));
+
+	slot->setIndex(tileIndex);
+
+	table_[tileIndex].store(slot, std::memory_order_release);
+
+	return slot;
+}
+
+template<typename T>
+void Canvas<T>::prefetchTile(int tileX, int tileY) {
+	if (tileX < 0 || tileY < 0 || tileX >= slotsPerRow_ || tileY >= slotsPerColumn_) {
+		return;
+	}
+
+	int tileIndex = tileY * slotsPerRow_ + tileX;
+
+	if (table_[tileIndex].load(std::memory_order_acquire) || requested_[tileIndex].exchange(true, std::memory_order_relaxed)) {
+		return;
+	}
+
+	pendingPrefetches_.fetch_add(1, std::memory_order_relaxed);
+
+	bool submitted = prefetcher_->submit([this, tileIndex]() {
+		// The request ends even if the load fails, ~Canvas waits for it. The worker needing the tile loads it again.
+		try {
+			size_t hits = 0;
+			pin(tileIndex, hits, true)->unpin();
 		}
-		else if (dumping_ && freeSlot->getChangesCount()) {
-			band_->raster(0, freeSlot->getOffsetY(), tileWidth_, freeSlot->getHeight(), freeSlot->getGrid().data(), tileWidth_, freeSlot->getHeight());
+		catch (...) {
+
+		}
+
+		requested_[tileIndex].store(false, std::memory_order_relaxed);
+		pendingPrefetches_.fetch_sub(1, std::memory_order_release);
+		});
+
+	if (!submitted) {
+		requested_[tileIndex].store(false, std::memory_order_relaxed);
+		pendingPrefetches_.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+template<typename T>
+void Canvas<T>::load(Slot<T>* slot) {
+	auto& grid = slot->getGrid();
+
+	int offsetX = slot->getOffsetX(), offsetY = slot->getOffsetY();
+	int width = slot->getWidth(), height = slot->getHeight();
+
+	if (grid.getWidth() != width || grid.getHeight() != height) {
+		grid.resize(width, height);
+	}
+
+	int error = 0;
+
+	auto& type = typeid(T);
+	if (type == typeid(float)) {
+		error = band_->rasterFloat(offsetX, offsetY, width, height, grid.data(), width, height);
+	}
+	else if (type == typeid(int8_t) || type == typeid(uint8_t)) {
+		error = band_->rasterByte(offsetX, offsetY, width, height, grid.data(), width, height);
+	}
+	else if (type == typeid(uint32_t)) {
+		error = band_->rasterUInt32(offsetX, offsetY, width, height, grid.data(), width, height);
+	}
+	else if (type == typeid(uint64_t)) {
+		error = band_->rasterUInt64(offsetX, offsetY, width, height, grid.data(), width, height);
+	}
+
+	// A garbage tile would be published and later written back over the raster
+	if (error) {
+		throw std::runtime_error("Canvas: Failed to read tile!");
+	}
+}
+
+template<typename T>
+void Canvas<T>::queueWrite(Slot<T>* slot) {
+	// The cells leave with the tile and stay in the budget until written, the slot is loaded into a spare grid
+	budget_->acquire(slotSize_, true);
+
+	std::unique_lock lock(writesMtx_);
+
+	queuedWrites_[slot->getIndex()] = std::move(slot->getGrid());
+	slot->getGrid() = Grid<T>();
+
+	if (!spareGrids_.empty()) {
+		slot->getGrid() = std::move(spareGrids_.back());
+		spareGrids_.pop_back();
+
+		budget_->release(slotSize_);
+	}
+
+	lock.unlock();
+
+	writesCv_.notify_all();
+}
+
+template<typename T>
+bool Canvas<T>::reclaim(Slot<T>* slot) {
+	if (!dumping_) {
+		return false;
+	}
+
+	std::unique_lock lock(writesMtx_);
+
+	auto queued = queuedWrites_.find(slot->getIndex());
+
+	if (queued != queuedWrites_.end()) {
+		std::swap(slot->getGrid(), queued->second);
+		slot->getChangesCount() = 1;
+
+		recycle(queued->second);
+		queuedWrites_.erase(queued);
+
+		return true;
+	}
+
+	// A tile being written is read back once it is done. Loads wait for the flusher when the queue is full,
+	// so the evictions they make can't pile up tiles faster than they are written.
+	writesCv_.wait(lock, [this, slot] { return !activeWrites_.count(slot->getIndex()) && queuedWrites_.size() < WRITE_QUEUE_LIMIT; });
+
+	return false;
+}
+
+template<typename T>
+void Canvas<T>::flushProcess() {
+	std::unique_lock lock(writesMtx_);
+
+	while (true) {
+		writesCv_.wait(lock, [this] { return stopping_ || !queuedWrites_.empty(); });
+
+		if (queuedWrites_.empty()) {
+			return;
 		}
 
-		picked = result = freeSlot;
+		// Everything queued at once, the more tiles the longer the merged runs
+		activeWrites_.swap(queuedWrites_);
 
-		result->setIndex(tileIndex);
-		result->setOffsetY(offsetY);
+		lock.unlock();
+		writesCv_.notify_all();
 
-		auto& grid = result->getGrid();
+		std::vector<Tile> tiles;
 
-		int height = min(tileHeight_ - offsetY, step_);
-		if (grid.getWidth() != tileWidth_ || grid.getHeight() != height) {
-			grid.resize(tileWidth_, height);
-			result->setHeight(height);
+		for (auto& [index, grid] : activeWrites_) {
+			tiles.push_back({ index, grid.data() });
 		}
 
-		auto& type = typeid(T);
-		if (type == typeid(float)) {
-			band_->rasterFloat(0, offsetY, tileWidth_, height, grid.data(), tileWidth_, height);
+		std::exception_ptr failure;
+
+		try {
+			write(tiles);
 		}
-		else if (type == typeid(int8_t)) {
-			band_->rasterByte(0, offsetY, tileWidth_, height, grid.data(), tileWidth_, height);
+		catch (...) {
+			failure = std::current_exception();
+		}
+
+		lock.lock();
+
+		if (failure && !writeFailure_) {
+			writeFailure_ = failure;
+		}
+
+		for (auto& [index, grid] : activeWrites_) {
+			recycle(grid);
 		}
-		else if (type == typeid(uint32_t)) {
-			band_->rasterUInt32(0, offsetY, tileWidth_, height, grid.data(), tileWidth_, height);
+
+		activeWrites_.clear();
+
+		writesCv_.notify_all();
+	}
+}
+
+template<typename T>
+void Canvas<T>::recycle(Grid<T>& grid) {
+	// Spares keep the budget of the queued cells they held
+	if (grid.capacity() && spareGrids_.size() < WRITE_QUEUE_LIMIT) {
+		spareGrids_.push_back(std::move(grid));
+	}
+	else {
+		budget_->release(slotSize_);
+	}
+
+	grid = Grid<T>();
+}
+
+template<typename T>
+void Canvas<T>::flush() {
+	if (!dumping_) {
+		return;
+	}
+
+	// Prefetches still running could evict slots while they are collected
+	while (pendingPrefetches_.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+
+	{
+		std::unique_lock lock(writesMtx_);
+
+		writesCv_.wait(lock, [this] { return queuedWrites_.empty() && activeWrites_.empty(); });
+
+		if (writeFailure_) {
+			std::rethrow_exception(writeFailure_);
 		}
-		else if (type == typeid(uint64_t)) {
-			band_->rasterUInt64(0, offsetY, tileWidth_, height, grid.data(), tileWidth_, height);
+	}
+
+	std::vector<Tile> tiles;
+
+	for (auto& slot : slots_) {
+		if (slot->getChangesCount()) {
+			tiles.push_back({ slot->getIndex(), slot->getGrid().data() });
+			slot->getChangesCount() = 0;
 		}
 	}
 
-	return DataHolder<T>(picked->getGrid().at(x, y - offsetY), picked.get());
+	std::sort(tiles.begin(), tiles.end(), [](const Tile& left, const Tile& right) { return left.index < right.index; });
+
+	write(tiles);
+}
+
+template<typename T>
+void Canvas<T>::write(const std::vector<Tile>& tiles) {
+	for (size_t begin = 0, end; begin < tiles.size(); begin = end) {
+		int tileX = tiles[begin].index % slotsPerRow_, tileY = tiles[begin].index / slotsPerRow_;
+
+		int offsetX = tileX * slotWidth_, offsetY = tileY * slotHeight_;
+		int width = min(width_ - offsetX, slotWidth_), height = min(height_ - offsetY, slotHeight_);
+
+		// Next tiles in the row, tiles of a single column are strips and join below each other
+		for (end = begin + 1; end < tiles.size() && tiles[end].index == tiles[end - 1].index + 1; end++) {
+			int nextX = tiles[end].index % slotsPerRow_, nextY = tiles[end].index / slotsPerRow_;
+
+			int runWidth = width, runHeight = height;
+
+			if (nextY == tileY) {
+				runWidth += min(width_ - nextX * slotWidth_, slotWidth_);
+			}
+			else if (slotsPerRow_ == 1) {
+				runHeight += min(height_ - nextY * slotHeight_, slotHeight_);
+			}
+			else {
+				break;
+			}
+
+			if (size_t(runWidth) * runHeight * sizeof(T) > WRITE_RUN_BYTES) {
+				break;
+			}
+
+			width = runWidth;
+			height = runHeight;
+		}
+
+		const T* data = tiles[begin].data;
+
+		if (end - begin > 1) {
+			writeBuffer_.resize(size_t(width) * height);
+
+			for (size_t i = begin; i < end; i++) {
+				int x = tiles[i].index % slotsPerRow_ * slotWidth_ - offsetX;
+				int y = tiles[i].index / slotsPerRow_ * slotHeight_ - offsetY;
+				int tileWidth = min(width_ - offsetX - x, slotWidth_);
+				int tileHeight = min(height_ - offsetY - y, slotHeight_);
+
+				for (int row = 0; row < tileHeight; row++) {
+					memcpy(writeBuffer_.data() + size_t(y + row) * width + x, tiles[i].data + size_t(row) * tileWidth, tileWidth * sizeof(T));
+				}
+			}
+
+			data = writeBuffer_.data();
+		}
+
+		if (band_->raster(offsetX, offsetY, width, height, (void*)data, width, height)) {
+			throw std::runtime_error("Canvas: Failed to write tiles!");
+		}
+
+		bandWrites_.fetch_add(1, std::memory_order_relaxed);
+	}
 }
 
 template<typename T>
 int Canvas<T>::getWidth() {
-	return tileWidth_;
+	return width_;
 }
 
 template<typename T>
 int Canvas<T>::getHeight() {
-	return tileHeight_;
+	return height_;
+}
+
+template<typename T>
+int Canvas<T>::getSlotWidth() {
+	return slotWidth_;
+}
+
+template<typename T>
+int Canvas<T>::getSlotHeight() {
+	return slotHeight_;
+}
+
+template<typename T>
+void Canvas<T>::setPrefetcher(PREFETCHER prefetcher) {
+	if (prefetcher && !requested_) {
+		size_t tilesCount = size_t(slotsPerRow_) * slotsPerColumn_;
+
+		requested_.reset(new std::atomic<bool>[tilesCount]);
+
+		for (size_t i = 0; i < tilesCount; i++) {
+			requested_[i].store(false, std::memory_order_relaxed);
+		}
+	}
+
+	prefetcher_ = prefetcher;
+}
+
+template<typename T>
+void Canvas<T>::prefetch(int x, int y) {
+	if (prefetcher_ && x >= 0 && y >= 0 && x < width_ && y < height_) {
+		prefetchTile(x / slotWidth_, y / slotHeight_);
+	}
+}
+
+template<typename T>
+CanvasStatistics Canvas<T>::getStatistics() {
+	auto lock = Statistics::lock(slotsMtx_, WaitPoint::Slots);
+
+	CanvasStatistics statistics = statistics_;
+	statistics.hits += viewHits_.load(std::memory_order_relaxed);
+	statistics.slots = slots_.size();
+	statistics.writes = bandWrites_.load(std::memory_order_relaxed);
+
+	for (int i = 0; i < USER_CHUNKS; i++) {
+		User* users = users_[i].load(std::memory_order_acquire);
+
+		for (int j = 0; users && j < USERS_PER_CHUNK; j++) {
+			statistics.hits += users[j].hits.load(std::memory_order_relaxed);
+		}
+	}
+
+	return statistics;
+}
+
+template<typename T>
+SlotView<T>::SlotView(Slot<T>* slot) : slot_(slot) {
+
+}
+
+template<typename T>
+SlotView<T>::SlotView(const SlotView<T>& other) : slot_(other.slot_) {
+	if (slot_) {
+		slot_->pin();
+	}
+}
+
+template<typename T>
+SlotView<T>::~SlotView() {
+	if (slot_) {
+		slot_->unpin();
+	}
+}
+
+template<typename T>
+SlotView<T>& SlotView<T>::operator=(SlotView<T> other) {
+	std::swap(slot_, other.slot_);
+
+	return *this;
+}
+
+template<typename T>
+bool SlotView<T>::valid() {
+	return slot_ != nullptr;
+}
+
+template<typename T>
+int SlotView<T>::getOffsetX() {
+	return slot_->getOffsetX();
+}
+
+template<typename T>
+int SlotView<T>::getOffsetY() {
+	return slot_->getOffsetY();
+}
+
+template<typename T>
+int SlotView<T>::getWidth() {
+	return slot_->getWidth();
+}
+
+template<typename T>
+int SlotView<T>::getHeight() {
+	return slot_->getHeight();
+}
+
+template<typename T>
+T* SlotView<T>::row(int y) {
+	return slot_->getGrid().data() + size_t(y - slot_->getOffsetY()) * slot_->getWidth();
 }
 
 template<typename T>
@@ -172,14 +843,10 @@ DataHolder<T>::~DataHolder() {
 
 template<typename T>
 T DataHolder<T>::operator=(const T value) {
-	//std::lock_guard lock(mtx_);
-	if (value == previousValue_) {
-		slot_->changesCounter_--;
-	}
-	else if (value != *value_) {
-		if (*value_ == previousValue_) {
-			slot_->changesCounter_++;
-		}
+	// Counted once per holder, a write restoring the previous value doesn't count down as another writer
+	// may have changed a cell of the slot meanwhile
+	if (value != *value_ && *value_ == previousValue_) {
+		slot_->changesCounter_.fetch_add(1);
 	}
 
 	(*value_) = value;
@@ -209,6 +876,36 @@ const T& DataHolder<T>::data() {
 	return *value_;
 }
 
+template<typename T>
+T DataHolder<T>::fetchAdd(T value) {
+	T previous;
+
+	if constexpr (std::is_integral_v<T> && sizeof(T) == sizeof(char)) {
+		previous = (T)_InterlockedExchangeAdd8((volatile char*)value_, (char)value);
+	}
+	else if constexpr (std::is_integral_v<T> && sizeof(T) == sizeof(LONG)) {
+		previous = (T)_InterlockedExchangeAdd((volatile LONG*)value_, (LONG)value);
+	}
+	else if constexpr (std::is_integral_v<T> && sizeof(T) == sizeof(LONG64)) {
+		previous = (T)_InterlockedExchangeAdd64((volatile LONG64*)value_, (LONG64)value);
+	}
+	else {
+		throw std::logic_error("DataHolder: Atomic add is not supported for this type.");
+	}
+
+	if (value) {
+		slot_->changesCounter_.fetch_add(1);
+	}
+
+	return previous;
+}
+
+template<typename T>
+T DataHolder<T>::load() {
+	// Adding zero is a locked read with a full barrier and leaves the slot clean
+	return fetchAdd(T(0));
+}
+
 template<typename T>
 bool DataHolder<T>::valid() {
 	return value_ != nullptr;
@@ -222,6 +919,13 @@ template class DataHolder<uint64_t>;
 template class DataHolder<uint32_t>;
 template class DataHolder<double>;
 
+template class SlotView<float>;
+template class SlotView<uint8_t>;
+template class SlotView<int8_t>;
+template class SlotView<uint64_t>;
+template class SlotView<uint32_t>;
+template class SlotView<double>;
+
 template class Slot<float>;
 template class Slot<uint8_t>;
 template class Slot<int8_t>;
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <map>
+#include <mutex>
+#include <thread>
 
 #include "GdalTiffReader.h"
 #include "Grid.hpp"
+#include "MemoryBudget.h"
+#include "Prefetcher.h"
 #include "Spinlock.h"
+#include "Statistics.h"
 
 typedef std::shared_ptr<IGeoTiffReader> GEOTIFF_READER;
 typedef std::shared_ptr<IRasterBand> RASTER_BAND;
@@ -24,6 +32,12 @@ public:
 	operator T();
 	const T& data();
 
+	// Atomically adds value to the cell, returns the previous one
+	T fetchAdd(T value);
+
+	// Atomically reads the cell changed by other threads with fetchAdd, later reads see what they wrote before
+	T load();
+
 	bool valid();
 
 private:
@@ -35,6 +49,9 @@ private:
 template<typename T>
 class Slot {
 public:
+	// Pin count of a slot being loaded, pins taken meanwhile see a negative count and back off
+	static constexpr int LOADING = -(1 << 30);
+
 	Slot() = default;
 
 	Grid<T>& getGrid();
@@ -42,50 +59,188 @@ public:
 	void setIndex(int index);
 	int getIndex();
 
+	void setWidth(int width);
+	int getWidth();
+
 	void setHeight(int height);
 	int getHeight();
 
+	void setOffsetX(int offsetX);
+	int getOffsetX();
+
 	void setOffsetY(int offsetY);
 	int getOffsetY();
 
-	int& getChangesCount();
+	std::atomic<int>& getChangesCount();
+
+	void setLastUse(size_t lastUse);
+	size_t getLastUse();
+
+	// Pins the slot if it holds the tile index and isn't being loaded
+	bool tryPin(int index);
+	void pin();
+	void unpin();
+	int getPins();
+
+	// Takes an unpinned slot for loading, publish() ends it pinned once
+	bool tryEvict();
+	void publish();
 
 private:
 	Grid<T> grid_;
 
-	int index_ = 0;
+	std::atomic<int> index_{ -1 };
+	int width_ = 0;
 	int height_ = 0;
+	int offsetX_ = 0;
 	int offsetY_ = 0;
 
-	int changesCounter_ = 0;
+	std::atomic<int> changesCounter_{ 0 }; // Changed by any writer of the slot, never counted down
+	std::atomic<size_t> lastUse_{ 0 };
+	std::atomic<int> pins_{ LOADING };
 
-	friend DataHolder;
+	friend class DataHolder<T>;
 };
 
+// Pins a slot for raw row access, writable views mark the slot as changed once
 template<typename T>
-class Canvas {
+class SlotView {
 public:
-	typedef std::shared_ptr<Slot<T>> SLOT;
+	// Takes over a pin of the slot
+	SlotView(Slot<T>* slot);
+	SlotView(const SlotView<T>& other);
+	SlotView() = default;
+	~SlotView();
+
+	SlotView<T>& operator=(SlotView<T> other);
+
+	bool valid();
 
-	Canvas(RASTER_BAND band, bool rareLocking, bool dumping = false);
+	int getOffsetX();
+	int getOffsetY();
+	int getWidth();
+	int getHeight();
+
+	// Cells of the row y (raster coordinates) starting from getOffsetX(), getWidth() of them
+	T* row(int y);
+
+private:
+	Slot<T>* slot_ = nullptr;
+};
+
+template<typename T>
+class Canvas {
+public:
+	// Slots are 2D tiles made of whole native blocks, slotWidth x slotHeight cells are rounded up to them (1024 x 1024 if zero).
+	// A dumping canvas computes the min/max statistics of the band at the end if minMax is set, reading all of it again.
+	Canvas(RASTER_BAND band, bool dumping = false, MEMORY_BUDGET budget = nullptr, int slotWidth = 0, int slotHeight = 0, bool minMax = true);
 	~Canvas();
 
+	// Each user index keeps its last slot pinned, a DataHolder stays valid until the next call with the same index.
+	// Use ~index for a second lookup of the same thread, -index collides with index for 0.
 	DataHolder<T> at(int x, int y, int index = 0);
+	SlotView<T> view(int x, int y, bool writable = false);
 
 	int getWidth();
 	int getHeight();
 
+	int getSlotWidth();
+	int getSlotHeight();
+
+	// Users crossing into another tile get the next depth tiles in the same direction loaded ahead
+	void setPrefetcher(PREFETCHER prefetcher);
+
+	// Loads the tile of the cell on an I/O thread unless it is loaded or requested already
+	void prefetch(int x, int y);
+
+	// Waits for the queued write-backs and writes the changed slots, none may be in use meanwhile.
+	// Throws if a write failed, a write-back of the flusher included.
+	void flush();
+
+	CanvasStatistics getStatistics();
+
 private:
+	struct alignas(64) User {
+		Slot<T>* slot = nullptr;
+		std::atomic<size_t> hits{ 0 }; // Read by the statistics while the user runs
+	};
+
+	// Cells of a changed tile, owned by a slot or by the write queue
+	struct Tile {
+		int index = 0;
+		const T* data = nullptr;
+	};
+
+	static constexpr int USERS_PER_CHUNK = 64;
+	static constexpr int USER_CHUNKS = 1024;
+
+	static constexpr size_t WRITE_QUEUE_LIMIT = 16; // Evicted tiles waiting for the flusher, evictions block past it
+	static constexpr size_t WRITE_RUN_BYTES = 64 << 20; // Largest merged write
+
+	User& getUser(int index);
+
+	Slot<T>* pin(int tileIndex, size_t& hits, bool prefetching = false);
+	Slot<T>* acquire(int tileIndex);
+	void prefetchTile(int tileX, int tileY);
+	void load(Slot<T>* slot);
+
+	// Hands the cells of a dirty slot being evicted over to the flusher
+	void queueWrite(Slot<T>* slot);
+
+	// Takes the tile of the slot back from the write queue, false if it has to be read from the band
+	bool reclaim(Slot<T>* slot);
+
+	void flushProcess();
+
+	// Keeps the grid of a written or reclaimed tile for the next eviction, under writesMtx_
+	void recycle(Grid<T>& grid);
+
+	// Tiles sorted by index, runs of neighbours in a tile row (or a column of strips) are written at once
+	void write(const std::vector<Tile>& tiles);
+
 	RASTER_BAND band_;
-	std::vector<SLOT> slots_;
-	std::map<int, SLOT> users_;
+	std::vector<std::unique_ptr<Slot<T>>> slots_;
+
+	// Loaded slot of every tile, looked up without locking
+	std::unique_ptr<std::atomic<Slot<T>*>[]> table_;
+	std::unique_ptr<std::atomic<User*>[]> users_;
+
+	int width_ = 0;
+	int height_ = 0;
 
-	int tileWidth_ = 0;
-	int tileHeight_ = 0;
-	int step_ = 1000;
+	int slotWidth_ = 0;
+	int slotHeight_ = 0;
+	int slotsPerRow_ = 0;
+	int slotsPerColumn_ = 0;
+
+	MEMORY_BUDGET budget_;
+	size_t slotSize_ = 0;
+	std::atomic<size_t> tick_{ 0 };
+
+	CanvasStatistics statistics_;
+	std::atomic<size_t> viewHits_{ 0 };
+	int statisticsId_ = -1; // Attached to Statistics while alive
+
+	PREFETCHER prefetcher_;
+	std::unique_ptr<std::atomic<bool>[]> requested_; // Tiles queued for prefetching
+	std::atomic<int> pendingPrefetches_{ 0 };
 
 	bool dumping_;
-	bool rareLocking_ = true;
+	bool minMax_;
 
 	Spinlock slotsMtx_;
+
+	// Write-behind of the evicted dirty tiles by index, the active ones are being written by the flusher
+	std::map<int, Grid<T>> queuedWrites_;
+	std::map<int, Grid<T>> activeWrites_;
+	std::vector<Grid<T>> spareGrids_;
+	std::vector<T> writeBuffer_; // Merged runs, used by the flusher or by flush() while the flusher is idle
+	std::atomic<size_t> bandWrites_{ 0 };
+
+	std::mutex writesMtx_;
+	std::condition_variable writesCv_;
+	bool stopping_ = false;
+	std::exception_ptr writeFailure_; // First failed write of the flusher, rethrown by flush()
+
+	std::thread flusher_;
 };
\ No newline at end of file
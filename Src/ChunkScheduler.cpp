@@ -0,0 +1,166 @@
+#include "pch.h"
+
+#include "ChunkScheduler.h"
+
+#include <climits>
+#include <thread>
+
+#include "Statistics.h"
+
+ChunkScheduler::ChunkScheduler(const std::vector<SourcesChunk>& chunks, int threadsCount, size_t grain, int tileWidth, int tileHeight) : grain_(max(grain, size_t(1))), tileWidth_(max(tileWidth, 1)), tileHeight_(max(tileHeight, 1)) {
+	if (threadsCount <= 0) {
+		throw std::runtime_error("ChunkScheduler: Invalid threads count!");
+	}
+
+	for (int i = 0; i < threadsCount; i++) {
+		workers_.push_back(std::make_unique<Worker>());
+	}
+
+	size_t pending = 0;
+
+	for (size_t i = 0; i < chunks.size(); i++) {
+		workers_[i * threadsCount / chunks.size()]->chunks.push_back(chunks[i]);
+
+		pending += chunks[i].count;
+	}
+
+	pending_ = pending;
+}
+
+bool ChunkScheduler::pop(int thread, SourcesChunk& grain) {
+	Worker& worker = *workers_[thread];
+
+	while (true) {
+		{
+			auto lock = Statistics::lock(worker.mutex, WaitPoint::Chunks);
+
+			if (!worker.chunks.empty()) {
+				SourcesChunk& front = worker.chunks.front();
+
+				grain = { front.data, min(grain_, front.count), front.offset };
+
+				front.data += grain.count;
+				front.count -= grain.count;
+				front.offset += grain.count;
+
+				if (!front.count) {
+					worker.chunks.pop_front();
+				}
+
+				const Source& last = grain.data[grain.count - 1];
+
+				worker.tileX = last.x / tileWidth_;
+				worker.tileY = last.y / tileHeight_;
+
+				pending_.fetch_sub(grain.count, std::memory_order_relaxed);
+
+				return true;
+			}
+		}
+
+		if (!pending_.load(std::memory_order_relaxed)) {
+			return false;
+		}
+
+		SourcesChunk stolen;
+
+		if (steal(thread, stolen)) {
+			auto lock = Statistics::lock(worker.mutex, WaitPoint::Chunks);
+
+			worker.chunks.push_front(stolen);
+			worker.stolen++;
+		}
+		else {
+			// The rest is being worked on or moved between deques
+			std::this_thread::yield();
+		}
+	}
+}
+
+size_t ChunkScheduler::getStolenCount(int thread) {
+	return workers_[thread]->stolen;
+}
+
+bool ChunkScheduler::steal(int thief, SourcesChunk& chunk) {
+	const Worker& worker = *workers_[thief];
+
+	int best = -1;
+	int bestDistance = INT_MAX;
+
+	for (int i = 0; i < int(workers_.size()); i++) {
+		if (i == thief) {
+			continue;
+		}
+
+		auto lock = Statistics::lock(workers_[i]->mutex, WaitPoint::Chunks);
+
+		size_t index;
+		int distance = findCandidate(*workers_[i], worker, index);
+
+		if (distance < bestDistance) {
+			best = i;
+			bestDistance = distance;
+		}
+	}
+
+	if (best < 0) {
+		return false;
+	}
+
+	Worker& victim = *workers_[best];
+	auto lock = Statistics::lock(victim.mutex, WaitPoint::Chunks);
+
+	// The victim could have moved on since the scan
+	size_t index;
+	if (findCandidate(victim, worker, index) == INT_MAX) {
+		return false;
+	}
+
+	if (index) {
+		chunk = victim.chunks[index];
+		victim.chunks.erase(victim.chunks.begin() + index);
+	}
+	else {
+		SourcesChunk& front = victim.chunks.front();
+		size_t half = front.count / 2;
+
+		chunk = { front.data + half, front.count - half, front.offset + half };
+		front.count = half;
+	}
+
+	return true;
+}
+
+int ChunkScheduler::findCandidate(Worker& victim, const Worker& thief, size_t& index) {
+	int bestDistance = INT_MAX;
+
+	// From the back, the chunks the owner would reach last win the ties
+	for (size_t i = victim.chunks.size(); i-- > 1;) {
+		int distance = getDistance(thief, victim.chunks[i].data[0]);
+
+		if (distance < bestDistance) {
+			index = i;
+			bestDistance = distance;
+		}
+	}
+
+	if (!victim.chunks.empty() && victim.chunks.front().count >= grain_ * 2) {
+		const SourcesChunk& front = victim.chunks.front();
+		int distance = getDistance(thief, front.data[front.count / 2]);
+
+		if (distance < bestDistance) {
+			index = 0;
+			bestDistance = distance;
+		}
+	}
+
+	return bestDistance;
+}
+
+int ChunkScheduler::getDistance(const Worker& thief, const Source& source) {
+	if (thief.tileX < 0) {
+		return 0;
+	}
+
+	return max(abs(source.x / tileWidth_ - thief.tileX), abs(source.y / tileHeight_ - thief.tileY));
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "SourcesList.h"
+#include "Spinlock.h"
+
+// Sources chunks of the accumulation on per-thread deques. An owner takes grains off the front chunk of its deque and
+// leaves the rest there, so a costly chunk is never held whole. Idle threads steal a chunk, or the back half of the one
+// being worked on, picking the chunk closest to the tile of the last source they walked from.
+class ChunkScheduler {
+public:
+	// Chunks are dealt out in contiguous runs, neighbouring sources stay with one thread
+	ChunkScheduler(const std::vector<SourcesChunk>& chunks, int threadsCount, size_t grain, int tileWidth, int tileHeight);
+
+	// Next grain of the thread, false once every source has been handed out
+	bool pop(int thread, SourcesChunk& grain);
+
+	size_t getStolenCount(int thread);
+
+private:
+	struct alignas(64) Worker {
+		std::deque<SourcesChunk> chunks;
+		Spinlock mutex;
+
+		int tileX = -1; // Tile of the last source handed out, -1 before the first grain
+		int tileY = -1;
+		size_t stolen = 0;
+	};
+
+	bool steal(int thief, SourcesChunk& chunk);
+
+	// Closest stealable chunk of the victim to the thief, INT_MAX if there is none. The front chunk is only split.
+	int findCandidate(Worker& victim, const Worker& thief, size_t& index);
+	int getDistance(const Worker& thief, const Source& source);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<size_t> pending_{ 0 }; // Sources not handed out yet, including chunks in transit between deques
+
+	size_t grain_ = 0;
+	int tileWidth_ = 0;
+	int tileHeight_ = 0;
+};
\ No newline at end of file
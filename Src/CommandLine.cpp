@@ -0,0 +1,326 @@
+#include "pch.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Benchmark.h"
+#include "Plugin.h"
+#include "Statistics.h"
+#include "TerrainGenerator.h"
+#include "TileJob.h"
+
+static const char* USAGE =
+	"Usage:\n"
+	"  process <terrain> <output> [--threads N] [--mode paths|tiled] [--fill] [--budget MB] [--report FILE] [--stats FILE] [--prefetch THREADS,DEPTH]\n"
+	"  generate <plane|fractal|flats|coast|valley> <width> <height> <output> [--seed N]\n"
+	"  benchmark <directory> [--kinds plane,fractal,flats,coast,valley] [--sizes 1024,4096] [--threads 1,4] [--repeats N] [--report FILE] [--verify] [--workers N]\n"
+	"  job create <terrain> <output> <directory> [--tile WIDTH,HEIGHT]\n"
+	"  job work <directory> <directions|perimeters|accumulation> <worker> <workers> [--threads N] [--budget MB]\n"
+	"  job merge <directory> <directions|perimeters|accumulation> [--threads N] [--budget MB]\n"
+	"  job run <terrain> <output> <directory> [--workers N] [--threads N] [--budget MB] [--tile WIDTH,HEIGHT]\n";
+
+static std::vector<std::string> splitList(const std::string& list) {
+	std::vector<std::string> items;
+	std::istringstream stream(list);
+
+	for (std::string item; std::getline(stream, item, ',');) {
+		if (!item.empty()) {
+			items.push_back(item);
+		}
+	}
+
+	return items;
+}
+
+static std::vector<int> parseIntList(const std::string& list) {
+	std::vector<int> values;
+
+	for (auto& item : splitList(list)) {
+		values.push_back(std::stoi(item));
+	}
+
+	return values;
+}
+
+// Positional arguments and --key value options, flags get an empty value
+static void parseArguments(int argc, const char* const* argv, std::vector<std::string>& positional, std::vector<std::pair<std::string, std::string>>& options) {
+	for (int i = 0; i < argc; i++) {
+		std::string argument = argv[i];
+
+		if (argument.rfind("--", 0) != 0) {
+			positional.push_back(argument);
+		}
+		else if (argument == "--fill" || argument == "--verify") {
+			options.push_back({ argument, "" });
+		}
+		else if (i + 1 < argc) {
+			options.push_back({ argument, argv[++i] });
+		}
+		else {
+			throw std::runtime_error("CommandLine: No value for " + argument + "!");
+		}
+	}
+}
+
+static int runProcess(const std::vector<std::string>& positional, const std::vector<std::pair<std::string, std::string>>& options) {
+	if (positional.size() != 3) {
+		throw std::runtime_error("CommandLine: process takes a terrain and an output!");
+	}
+
+	int threads = std::thread::hardware_concurrency();
+	std::string report;
+	std::string statistics;
+
+	Plugin& plugin = Plugin::getInstance();
+
+	for (auto& [key, value] : options) {
+		if (key == "--threads") {
+			threads = std::stoi(value);
+		}
+		else if (key == "--mode") {
+			if (value == "paths") {
+				plugin.setAccumulationMode(AccumulationMode::Paths);
+			}
+			else if (value == "tiled") {
+				plugin.setAccumulationMode(AccumulationMode::Tiled);
+			}
+			else {
+				throw std::runtime_error("CommandLine: Unknown mode " + value + "!");
+			}
+		}
+		else if (key == "--fill") {
+			plugin.setConditioning(Conditioning::FillDepressions);
+		}
+		else if (key == "--budget") {
+			plugin.setMemoryBudget(size_t(std::stoi(value)) * 1024 * 1024);
+		}
+		else if (key == "--report") {
+			report = value;
+		}
+		else if (key == "--stats") {
+			statistics = value;
+		}
+		else if (key == "--prefetch") {
+			auto prefetch = parseIntList(value);
+
+			if (prefetch.size() != 2) {
+				throw std::runtime_error("CommandLine: --prefetch takes threads and depth!");
+			}
+
+			plugin.setPrefetch(max(prefetch[0], 0), max(prefetch[1], 1));
+		}
+		else {
+			throw std::runtime_error("CommandLine: Unknown option " + key + "!");
+		}
+	}
+
+	plugin.process(positional[1], positional[2], threads);
+
+	const RunReport& result = plugin.getReport();
+
+	if (!report.empty()) {
+		std::ofstream file(report, std::ios::trunc);
+		file << Benchmark::formatReport(positional[1], threads, result) << std::endl;
+	}
+
+	if (!statistics.empty()) {
+		std::ofstream file(statistics, std::ios::trunc);
+		file << Statistics::getInstance().toJson() << std::endl;
+	}
+
+	return result.succeeded ? 0 : 1;
+}
+
+static int runGenerate(const std::vector<std::string>& positional, const std::vector<std::pair<std::string, std::string>>& options) {
+	if (positional.size() != 5) {
+		throw std::runtime_error("CommandLine: generate takes a kind, a size and an output!");
+	}
+
+	unsigned seed = 1;
+
+	for (auto& [key, value] : options) {
+		if (key == "--seed") {
+			seed = unsigned(std::stoul(value));
+		}
+		else {
+			throw std::runtime_error("CommandLine: Unknown option " + key + "!");
+		}
+	}
+
+	TerrainGenerator generator(TerrainGenerator::parseKind(positional[1]), std::stoi(positional[2]), std::stoi(positional[3]), seed);
+	generator.generate(positional[4]);
+
+	return 0;
+}
+
+static int runBenchmark(const std::vector<std::string>& positional, const std::vector<std::pair<std::string, std::string>>& options) {
+	if (positional.size() != 2) {
+		throw std::runtime_error("CommandLine: benchmark takes a directory!");
+	}
+
+	BenchmarkOptions benchmarkOptions;
+	benchmarkOptions.directory = positional[1];
+
+	for (auto& [key, value] : options) {
+		if (key == "--kinds") {
+			benchmarkOptions.kinds.clear();
+
+			for (auto& kind : splitList(value)) {
+				benchmarkOptions.kinds.push_back(TerrainGenerator::parseKind(kind));
+			}
+		}
+		else if (key == "--sizes") {
+			benchmarkOptions.sizes = parseIntList(value);
+		}
+		else if (key == "--threads") {
+			benchmarkOptions.threads = parseIntList(value);
+		}
+		else if (key == "--repeats") {
+			benchmarkOptions.repeats = std::stoi(value);
+		}
+		else if (key == "--report") {
+			benchmarkOptions.report = value;
+		}
+		else if (key == "--verify") {
+			benchmarkOptions.verify = true;
+		}
+		else if (key == "--workers") {
+			benchmarkOptions.workers = std::stoi(value);
+		}
+		else {
+			throw std::runtime_error("CommandLine: Unknown option " + key + "!");
+		}
+	}
+
+	Benchmark benchmark(benchmarkOptions);
+
+	return benchmark.run() ? 1 : 0;
+}
+
+static int parseStage(const std::string& stage) {
+	if (stage == "directions") {
+		return int(TileJob::Stage::Directions);
+	}
+
+	if (stage == "perimeters") {
+		return int(TileJob::Stage::Perimeters);
+	}
+
+	if (stage == "accumulation") {
+		return int(TileJob::Stage::Accumulation);
+	}
+
+	throw std::runtime_error("CommandLine: Unknown stage " + stage + "!");
+}
+
+// Every stage is run by all the workers, each one a separate process, then merged once before the next stage starts.
+// run does it all on this host, starting the workers as processes of this runner.
+static int runJob(const std::vector<std::string>& positional, const std::vector<std::pair<std::string, std::string>>& options) {
+	std::string command = positional.size() > 1 ? positional[1] : "";
+
+	int threads = std::thread::hardware_concurrency();
+	int workers = 2;
+
+	Plugin& plugin = Plugin::getInstance();
+
+	for (auto& [key, value] : options) {
+		if (key == "--threads" && (command == "work" || command == "merge" || command == "run")) {
+			threads = std::stoi(value);
+		}
+		else if (key == "--workers" && command == "run") {
+			workers = std::stoi(value);
+		}
+		else if (key == "--budget" && command != "create") {
+			plugin.setMemoryBudget(size_t(std::stoi(value)) * 1024 * 1024);
+		}
+		else if (key == "--tile" && (command == "create" || command == "run")) {
+			auto tile = parseIntList(value);
+
+			if (tile.size() != 2) {
+				throw std::runtime_error("CommandLine: --tile takes a width and a height!");
+			}
+
+			plugin.setTileSize(max(tile[0], 0), max(tile[1], 0));
+		}
+		else {
+			throw std::runtime_error("CommandLine: Unknown option " + key + "!");
+		}
+	}
+
+	if (command == "create" && positional.size() == 5) {
+		plugin.createJob(positional[2], positional[3], positional[4]);
+
+		return 0;
+	}
+
+	if (command == "work" && positional.size() == 6) {
+		plugin.runJobWorker(positional[2], parseStage(positional[3]), std::stoi(positional[4]), std::stoi(positional[5]), threads);
+
+		return 0;
+	}
+
+	if (command == "merge" && positional.size() == 4) {
+		plugin.mergeJob(positional[2], parseStage(positional[3]), threads);
+
+		return 0;
+	}
+
+	// Threads of the host are shared by the workers
+	if (command == "run" && positional.size() == 5) {
+		plugin.runJob(positional[2], positional[3], positional[4], workers, max(threads / max(workers, 1), 1));
+
+		return 0;
+	}
+
+	throw std::runtime_error("CommandLine: job takes create, work, merge or run with their arguments!");
+}
+
+// Headless entry point for the console runner, arguments start with the command. Returns 0 on success, 2 on bad usage.
+EXPORT_API int RunCommandLine(int argc, const char* const* argv) {
+	std::vector<std::string> positional;
+	std::vector<std::pair<std::string, std::string>> options;
+
+	try {
+		parseArguments(argc, argv, positional, options);
+
+		if (positional.empty()) {
+			std::cout << USAGE;
+
+			return 2;
+		}
+
+		if (positional[0] == "process") {
+			return runProcess(positional, options);
+		}
+
+		if (positional[0] == "generate") {
+			return runGenerate(positional, options);
+		}
+
+		if (positional[0] == "benchmark") {
+			return runBenchmark(positional, options);
+		}
+
+		if (positional[0] == "job") {
+			return runJob(positional, options);
+		}
+
+		std::cout << USAGE;
+
+		return 2;
+	}
+	catch (const std::logic_error& exception) {
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+		std::cout << USAGE;
+
+		return 2;
+	}
+	catch (const std::exception& exception) {
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+		return 1;
+	}
+}
\ No newline at end of file
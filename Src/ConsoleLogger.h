@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <streambuf>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <thread>
 
 class ConsoleLogger {
 public:
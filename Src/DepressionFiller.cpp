@@ -0,0 +1,351 @@
+#include "pch.h"
+
+#include "DepressionFiller.h"
+
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+// Bytes per cell of a strip being flooded: elevations, labels and the worst case of the priority queue
+static const size_t STRIP_CELL_SIZE = sizeof(float) + sizeof(int64_t) + sizeof(std::pair<float, int>);
+
+DepressionFiller::DepressionFiller(RASTER_BAND terrain, std::optional<double> noData, MEMORY_BUDGET budget) : terrain_(terrain), noData_(noData), budget_(budget) {
+	width_ = terrain_->getXSize();
+	height_ = terrain_->getYSize();
+}
+
+void DepressionFiller::fill(RASTER_BAND output, int threadsCount) {
+	// Strips as high as a half of the free budget allows for all threads, but not fewer strips than threads
+	size_t freeMemory = budget_->getLimit() > budget_->getUsed() ? budget_->getLimit() - budget_->getUsed() : 0;
+	size_t stripCells = freeMemory / 2 / threadsCount / STRIP_CELL_SIZE;
+
+	stripRows_ = int(min(max(stripCells / width_, size_t(1)), size_t((height_ + threadsCount - 1) / threadsCount)));
+	stripRows_ = max(min(stripRows_, INT_MAX / width_), 1); // Cells are indexed by int inside a strip
+	stripsCount_ = (height_ + stripRows_ - 1) / stripRows_;
+
+	size_t workingSize = size_t(stripRows_ + 2) * width_ * STRIP_CELL_SIZE * threadsCount;
+	budget_->acquire(workingSize, true);
+
+	std::cout << "Fill strips: " << stripsCount_ << "x" << stripRows_ << " rows" << std::endl;
+
+	processed_ = 0;
+	perimeters_.assign(stripsCount_, Perimeter());
+
+	SPILLS spills;
+	std::mutex spillsMutex;
+
+	auto forEachStrip = [this, threadsCount](const std::function<void(int, std::vector<float>&, std::vector<int64_t>&)>& body) {
+		std::atomic_int nextStrip{ 0 };
+		std::exception_ptr failure;
+		std::mutex failureMutex;
+
+		std::vector<std::thread> threads;
+		threads.reserve(threadsCount);
+
+		for (int i = 0; i < threadsCount; i++) {
+			threads.emplace_back([this, &body, &nextStrip, &failure, &failureMutex]() {
+				std::vector<float> elevations;
+				std::vector<int64_t> labels;
+
+				try {
+					for (int strip = nextStrip++; strip < stripsCount_; strip = nextStrip++) {
+						body(strip, elevations, labels);
+
+						processed_++;
+					}
+				}
+				catch (...) {
+					std::unique_lock lock(failureMutex);
+
+					if (!failure) {
+						failure = std::current_exception();
+					}
+
+					nextStrip = stripsCount_;
+				}
+				});
+		}
+
+		for (auto& thread : threads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
+	};
+
+	try {
+		// Local floods, the spills between the labels met inside the strips and the perimeters for the ones across
+		forEachStrip([this, &spills, &spillsMutex](int strip, std::vector<float>& elevations, std::vector<int64_t>& labels) {
+			SPILLS stripSpills;
+
+			floodStrip(strip, elevations, labels, &stripSpills);
+
+			auto& perimeter = perimeters_[strip];
+			int rows = min(stripRows_, height_ - strip * stripRows_);
+
+			const float* cells = elevations.data() + width_;
+
+			perimeter.topLabels.assign(labels.begin(), labels.begin() + width_);
+			perimeter.topElevations.assign(cells, cells + width_);
+			perimeter.bottomLabels.assign(labels.begin() + size_t(rows - 1) * width_, labels.begin() + size_t(rows) * width_);
+			perimeter.bottomElevations.assign(cells + size_t(rows - 1) * width_, cells + size_t(rows) * width_);
+
+			std::unique_lock lock(spillsMutex);
+
+			for (auto& [key, elevation] : stripSpills) {
+				addSpill(spills, key.first, key.second, elevation);
+			}
+			});
+
+		for (int strip = 0; strip + 1 < stripsCount_; strip++) {
+			auto& upper = perimeters_[strip];
+			auto& lower = perimeters_[strip + 1];
+
+			for (int x = 0; x < width_; x++) {
+				for (int i = -1; i <= 1; i++) {
+					int nx = x + i;
+
+					if (nx < 0 || nx >= width_ || !upper.bottomLabels[x] || !lower.topLabels[nx] || upper.bottomLabels[x] == lower.topLabels[nx]) {
+						continue;
+					}
+
+					addSpill(spills, upper.bottomLabels[x], lower.topLabels[nx], max(upper.bottomElevations[x], lower.topElevations[nx]));
+				}
+			}
+		}
+
+		perimeters_.clear();
+
+		solveSpillGraph(spills, 2 + int64_t(stripsCount_) * 2 * width_);
+		spills.clear();
+
+		// The same floods again, raised to the spill levels of their labels
+		forEachStrip([this, &output](int strip, std::vector<float>& elevations, std::vector<int64_t>& labels) {
+			floodStrip(strip, elevations, labels, nullptr);
+
+			int top = strip * stripRows_;
+			int rows = min(stripRows_, height_ - top);
+
+			float* cells = elevations.data() + width_;
+
+			for (size_t c = 0; c < size_t(rows) * width_; c++) {
+				if (labels[c]) {
+					cells[c] = max(cells[c], levels_[labels[c]]);
+				}
+			}
+
+			if (output->raster(0, top, width_, rows, cells, width_, rows)) {
+				throw std::runtime_error("DepressionFilling: Failed to write terrain!");
+			}
+			});
+	}
+	catch (...) {
+		budget_->release(workingSize);
+
+		throw;
+	}
+
+	levels_ = std::vector<float>();
+
+	budget_->release(workingSize);
+}
+
+int DepressionFiller::getProgress() {
+	return stripsCount_ ? int(processed_.load() * 100 / (stripsCount_ * 2)) : 0;
+}
+
+bool DepressionFiller::isNoData(float value) {
+	return std::isnan(value) || (noData_.has_value() && value == noData_.value());
+}
+
+void DepressionFiller::readStrip(int strip, std::vector<float>& elevations) {
+	int top = strip * stripRows_;
+	int rows = min(stripRows_, height_ - top);
+
+	// A halo row above and below, NaN outside of the raster
+	int first = max(top - 1, 0);
+	int last = min(top + rows + 1, height_);
+
+	elevations.assign(size_t(rows + 2) * width_, std::numeric_limits<float>::quiet_NaN());
+
+	float* data = elevations.data() + size_t(first - (top - 1)) * width_;
+	if (terrain_->rasterFloat(0, first, width_, last - first, data, width_, last - first)) {
+		throw std::runtime_error("DepressionFilling: Failed to read terrain!");
+	}
+}
+
+void DepressionFiller::floodStrip(int strip, std::vector<float>& elevations, std::vector<int64_t>& labels, SPILLS* spills) {
+	typedef std::pair<float, int> CELL;
+
+	int top = strip * stripRows_;
+	int rows = min(stripRows_, height_ - top);
+	int width = width_;
+
+	readStrip(strip, elevations);
+	labels.assign(size_t(rows) * width, 0);
+
+	float* cells = elevations.data() + width; // Past the upper halo row
+
+	std::priority_queue<CELL, std::vector<CELL>, std::greater<CELL>> open;
+	std::queue<int> pit; // Cells raised to the level being flooded, no need to sort them
+
+	// Cells at the raster edge or next to nodata drain off it, the rest of the strip perimeter get labels of their own
+	int64_t labelsOffset = 2 + int64_t(strip) * 2 * width;
+
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < width; x++) {
+			int c = y * width + x;
+
+			if (isNoData(cells[c])) {
+				continue;
+			}
+
+			bool ocean = x == 0 || x == width - 1 || top + y == 0 || top + y == height_ - 1;
+
+			for (int j = -1; j <= 1 && !ocean; j++) {
+				for (int i = -1; i <= 1 && !ocean; i++) {
+					ocean = isNoData(cells[c + j * width + i]);
+				}
+			}
+
+			if (ocean) {
+				labels[c] = OCEAN;
+			}
+			else if (y == 0) {
+				labels[c] = labelsOffset + x;
+			}
+			else if (y == rows - 1) {
+				labels[c] = labelsOffset + width + x;
+			}
+			else {
+				continue;
+			}
+
+			open.push({ cells[c], c });
+		}
+	}
+
+	while (!open.empty() || !pit.empty()) {
+		int c;
+
+		if (!pit.empty()) {
+			c = pit.front();
+			pit.pop();
+		}
+		else {
+			c = open.top().second;
+			open.pop();
+		}
+
+		int x = c % width;
+		int y = c / width;
+
+		for (int j = -1; j <= 1; j++) {
+			for (int i = -1; i <= 1; i++) {
+				int nx = x + i;
+				int ny = y + j;
+
+				if ((i == 0 && j == 0) || nx < 0 || nx >= width || ny < 0 || ny >= rows) {
+					continue;
+				}
+
+				int n = ny * width + nx;
+
+				if (isNoData(cells[n])) {
+					continue;
+				}
+
+				if (!labels[n]) {
+					labels[n] = labels[c];
+
+					if (cells[n] <= cells[c]) {
+						cells[n] = cells[c];
+						pit.push(n);
+					}
+					else {
+						open.push({ cells[n], n });
+					}
+				}
+				else if (spills && labels[n] != labels[c]) {
+					addSpill(*spills, labels[c], labels[n], max(cells[c], cells[n]));
+				}
+			}
+		}
+	}
+}
+
+void DepressionFiller::addSpill(SPILLS& spills, int64_t a, int64_t b, float elevation) {
+	auto [spill, inserted] = spills.emplace(a < b ? SPILL(a, b) : SPILL(b, a), elevation);
+
+	if (!inserted && elevation < spill->second) {
+		spill->second = elevation;
+	}
+}
+
+void DepressionFiller::solveSpillGraph(const SPILLS& spills, int64_t labelsCount) {
+	typedef std::pair<float, int64_t> LABEL;
+
+	// Adjacency lists of the labels packed into one array
+	std::vector<size_t> offsets(size_t(labelsCount) + 1, 0);
+
+	for (auto& [key, elevation] : spills) {
+		offsets[key.first + 1]++;
+		offsets[key.second + 1]++;
+	}
+
+	for (size_t i = 1; i < offsets.size(); i++) {
+		offsets[i] += offsets[i - 1];
+	}
+
+	std::vector<std::pair<int64_t, float>> edges(offsets.back());
+	std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+
+	for (auto& [key, elevation] : spills) {
+		int64_t a = key.first;
+		int64_t b = key.second;
+
+		edges[filled[a]++] = { b, elevation };
+		edges[filled[b]++] = { a, elevation };
+	}
+
+	// Priority-Flood over the graph: the level of a label is the lowest spill it reaches the ocean through
+	levels_.assign(size_t(labelsCount), std::numeric_limits<float>::infinity());
+	levels_[OCEAN] = -std::numeric_limits<float>::infinity();
+
+	std::priority_queue<LABEL, std::vector<LABEL>, std::greater<LABEL>> open;
+	open.push({ levels_[OCEAN], OCEAN });
+
+	while (!open.empty()) {
+		auto [level, label] = open.top();
+		open.pop();
+
+		if (level > levels_[label]) {
+			continue;
+		}
+
+		for (size_t e = offsets[label]; e < offsets[label + 1]; e++) {
+			auto [neighbour, elevation] = edges[e];
+			float spill = max(level, elevation);
+
+			if (spill < levels_[neighbour]) {
+				levels_[neighbour] = spill;
+				open.push({ spill, neighbour });
+			}
+		}
+	}
+
+	// Labels no cell carries are never reached, nor raised
+	for (auto& level : levels_) {
+		if (level == std::numeric_limits<float>::infinity()) {
+			level = -std::numeric_limits<float>::infinity();
+		}
+	}
+}
\ No newline at end of file
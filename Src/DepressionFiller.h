@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "Canvas.h"
+
+// Tiled parallel Priority-Flood (Barnes, Lehman, Mulla 2014). Every strip of rows is flooded on its own from its perimeter,
+// strips are joined by a spill graph of the perimeter labels, then each strip is flooded again and raised to the spill levels.
+class DepressionFiller {
+public:
+	DepressionFiller(RASTER_BAND terrain, std::optional<double> noData, MEMORY_BUDGET budget);
+
+	// Writes the filled terrain, same size as the source one, as Float32 into output
+	void fill(RASTER_BAND output, int threadsCount);
+
+	// Strips processed by both passes, 0..100
+	int getProgress();
+
+private:
+	static const int OCEAN = 1; // Label of the cells draining off the raster or into nodata
+
+	struct Perimeter {
+		std::vector<int64_t> topLabels;
+		std::vector<float> topElevations;
+		std::vector<int64_t> bottomLabels;
+		std::vector<float> bottomElevations;
+	};
+
+	// Labels of both sides, the lower one first. There are two per perimeter cell, more than an int holds on large rasters.
+	typedef std::pair<int64_t, int64_t> SPILL;
+
+	struct SpillHash {
+		size_t operator()(const SPILL& spill) const {
+			return std::hash<int64_t>()(spill.first * 0x9E3779B97F4A7C15ull ^ spill.second);
+		}
+	};
+
+	typedef std::unordered_map<SPILL, float, SpillHash> SPILLS;
+
+	bool isNoData(float value);
+
+	void readStrip(int strip, std::vector<float>& elevations);
+	void floodStrip(int strip, std::vector<float>& elevations, std::vector<int64_t>& labels, SPILLS* spills);
+
+	static void addSpill(SPILLS& spills, int64_t a, int64_t b, float elevation);
+	void solveSpillGraph(const SPILLS& spills, int64_t labelsCount);
+
+	RASTER_BAND terrain_;
+	std::optional<double> noData_;
+	MEMORY_BUDGET budget_;
+
+	int width_ = 0;
+	int height_ = 0;
+
+	int stripRows_ = 0;
+	int stripsCount_ = 0;
+
+	std::vector<Perimeter> perimeters_;
+	std::vector<float> levels_; // Spill elevation of every label
+
+	std::atomic_int processed_{ 0 };
+};
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "pch.h"
+
+#include "DirectionKernel.h"
+
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+#ifdef _WIN32
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+
+// GCC compiles the AVX2 kernel alone for it, the rest of the unit stays SSE2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static void cpuid(int info[4], int leaf, int subleaf) {
+#ifdef _WIN32
+	__cpuidex(info, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static unsigned long long xgetbv(unsigned index) {
+#ifdef _WIN32
+	return _xgetbv(index);
+#else
+	unsigned eax, edx;
+	__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+
+	return eax | (unsigned long long)edx << 32;
+#endif
+}
+
+DirectionKernel::DirectionKernel(int stride, const int8_t codes[8], std::optional<double> noData, int8_t noDataDirection, InstructionSet instructionSet) : noData_(noData), noDataDirection_(noDataDirection), instructionSet_(instructionSet) {
+	int k = 0;
+
+	for (int j = -1; j <= 1; j++) {
+		for (int i = -1; i <= 1; i++) {
+			if (i == 0 && j == 0) {
+				continue;
+			}
+
+			offsets_[k] = j * stride + i;
+			distances_[k] = (abs(i) + abs(j) == 2) ? 1.41 : 1.;
+			codes_[k] = codes[k];
+
+			edgeMasks_[0] |= (j < 0) << k;
+			edgeMasks_[1] |= (j > 0) << k;
+			edgeMasks_[2] |= (i < 0) << k;
+			edgeMasks_[3] |= (i > 0) << k;
+
+			k++;
+		}
+	}
+}
+
+bool DirectionKernel::computeRow(const float* terrain, int width, int8_t* directions, int edges) {
+	int invalid;
+
+	switch (instructionSet_) {
+	case InstructionSet::AVX2:
+		invalid = computeAVX2(terrain, width, directions, edges);
+		break;
+	case InstructionSet::SSE2:
+		invalid = computeSSE2(terrain, width, directions, edges);
+		break;
+	default:
+		invalid = computeScalar(terrain, 0, width, width, directions, edges);
+		break;
+	}
+
+	return !invalid;
+}
+
+int DirectionKernel::getEdges(int x, int y, int width, int rasterWidth, int rasterHeight) {
+	return (y == 0 ? EDGE_TOP : 0) | (y == rasterHeight - 1 ? EDGE_BOTTOM : 0) | (x == 0 ? EDGE_LEFT : 0) | (x + width == rasterWidth ? EDGE_RIGHT : 0);
+}
+
+int DirectionKernel::getOutside(int x, int width, int edges) {
+	int outside = 0;
+
+	for (int edge = 0; edge < 2; edge++) {
+		if (edges & (1 << edge)) {
+			outside |= edgeMasks_[edge];
+		}
+	}
+
+	if (x == 0 && (edges & EDGE_LEFT)) {
+		outside |= edgeMasks_[2];
+	}
+
+	if (x == width - 1 && (edges & EDGE_RIGHT)) {
+		outside |= edgeMasks_[3];
+	}
+
+	return outside;
+}
+
+DirectionKernel::InstructionSet DirectionKernel::getInstructionSet() {
+	return instructionSet_;
+}
+
+DirectionKernel::InstructionSet DirectionKernel::detectInstructionSet() {
+	static InstructionSet instructionSet = [] {
+		int info[4];
+
+		cpuid(info, 0, 0);
+		int maxLeaf = info[0];
+
+		cpuid(info, 1, 0);
+		bool osxsave = info[2] & (1 << 27);
+		bool avx = info[2] & (1 << 28);
+
+		// The OS has to preserve the ymm registers as well
+		if (maxLeaf >= 7 && osxsave && avx && (xgetbv(0) & 6) == 6) {
+			cpuid(info, 7, 0);
+
+			if (info[1] & (1 << 5)) {
+				return InstructionSet::AVX2;
+			}
+		}
+
+		return InstructionSet::SSE2; // Always present on x64
+	}();
+
+	return instructionSet;
+}
+
+const char* DirectionKernel::getInstructionSetName(InstructionSet instructionSet) {
+	switch (instructionSet) {
+	case InstructionSet::AVX2:
+		return "AVX2";
+	case InstructionSet::SSE2:
+		return "SSE2";
+	default:
+		return "Scalar";
+	}
+}
+
+int DirectionKernel::computeScalar(const float* terrain, int begin, int end, int width, int8_t* directions, int edges) {
+	int invalid = 0;
+
+	for (int x = begin; x < end; x++) {
+		const float* cell = terrain + x;
+		double from = *cell;
+
+		if (noData_.has_value() && from == noData_.value()) {
+			directions[x] = noDataDirection_;
+
+			continue;
+		}
+
+		double maxSlope = 0;
+		int8_t direction = 0;
+
+		int outside = getOutside(x, width, edges);
+
+		for (int k = 0; k < 8; k++) {
+			double to = cell[offsets_[k]];
+			if (outside & (1 << k)) {
+				to = from - 0.0001; // Outside of the raster. Precision = 0.9999
+			}
+
+			double deltaZ = from - to;
+			if (deltaZ <= 0) {
+				continue;
+			}
+
+			double slope = deltaZ / distances_[k];
+
+			if (slope > maxSlope) {
+				maxSlope = slope;
+				direction = codes_[k];
+			}
+		}
+
+		directions[x] = direction;
+		invalid |= !direction;
+	}
+
+	return invalid;
+}
+
+// The vector paths evaluate the same expression as the scalar one in double precision, lane by lane and
+// neighbour by neighbour, so the strict comparison keeps the first steepest neighbour and results are bit-identical.
+// A non-positive deltaZ never beats maxSlope, which starts at zero, so the scalar early-out needs no branch here.
+// A NaN slope fails every comparison in both. The first and last cells of a row at the left and right edges of the
+// raster are left to the scalar path, so the vector lanes only ever see the neighbours of the top and bottom edges.
+
+int DirectionKernel::computeSSE2(const float* terrain, int width, int8_t* directions, int edges) {
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d bias = _mm_set1_pd(0.0001);
+	const __m128d noData = _mm_set1_pd(noData_.value_or(0));
+	const __m128d noDataDirection = _mm_set1_pd(noDataDirection_);
+
+	auto blend = [](__m128d a, __m128d b, __m128d mask) {
+		return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a));
+	};
+
+	auto load = [](const float* data) {
+		return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)data)));
+	};
+
+	int first = (edges & EDGE_LEFT) ? min(1, width) : 0;
+	int last = (edges & EDGE_RIGHT) ? width - 1 : width;
+	int outside = getOutside(-1, width, edges);
+
+	int invalid = computeScalar(terrain, 0, first, width, directions, edges);
+	int x = first;
+
+	for (; x + 2 <= last; x += 2) {
+		const float* cell = terrain + x;
+
+		__m128d from = load(cell);
+		__m128d edge = _mm_sub_pd(from, bias);
+		__m128d maxSlope = zero;
+		__m128d direction = zero;
+
+		for (int k = 0; k < 8; k++) {
+			__m128d to = (outside & (1 << k)) ? edge : load(cell + offsets_[k]);
+
+			__m128d slope = _mm_div_pd(_mm_sub_pd(from, to), _mm_set1_pd(distances_[k]));
+			__m128d greater = _mm_cmpgt_pd(slope, maxSlope);
+
+			maxSlope = blend(maxSlope, slope, greater);
+			direction = blend(direction, _mm_set1_pd(codes_[k]), greater);
+		}
+
+		if (noData_.has_value()) {
+			direction = blend(direction, noDataDirection, _mm_cmpeq_pd(from, noData));
+		}
+
+		invalid |= _mm_movemask_pd(_mm_cmpeq_pd(direction, zero));
+
+		__m128i packed = _mm_cvttpd_epi32(direction);
+		packed = _mm_packs_epi32(packed, packed);
+		packed = _mm_packs_epi16(packed, packed);
+
+		uint16_t result = (uint16_t)_mm_cvtsi128_si32(packed);
+		memcpy(directions + x, &result, sizeof(result));
+	}
+
+	return invalid | computeScalar(terrain, x, width, width, directions, edges);
+}
+
+TARGET_AVX2 int DirectionKernel::computeAVX2(const float* terrain, int width, int8_t* directions, int edges) {
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d bias = _mm256_set1_pd(0.0001);
+	const __m256d noData = _mm256_set1_pd(noData_.value_or(0));
+	const __m256d noDataDirection = _mm256_set1_pd(noDataDirection_);
+
+	int first = (edges & EDGE_LEFT) ? min(1, width) : 0;
+	int last = (edges & EDGE_RIGHT) ? width - 1 : width;
+	int outside = getOutside(-1, width, edges);
+
+	int invalid = computeScalar(terrain, 0, first, width, directions, edges);
+	int x = first;
+
+	for (; x + 4 <= last; x += 4) {
+		const float* cell = terrain + x;
+
+		__m256d from = _mm256_cvtps_pd(_mm_loadu_ps(cell));
+		__m256d edge = _mm256_sub_pd(from, bias);
+		__m256d maxSlope = zero;
+		__m256d direction = zero;
+
+		for (int k = 0; k < 8; k++) {
+			__m256d to = (outside & (1 << k)) ? edge : _mm256_cvtps_pd(_mm_loadu_ps(cell + offsets_[k]));
+
+			__m256d slope = _mm256_div_pd(_mm256_sub_pd(from, to), _mm256_set1_pd(distances_[k]));
+			__m256d greater = _mm256_cmp_pd(slope, maxSlope, _CMP_GT_OQ);
+
+			maxSlope = _mm256_blendv_pd(maxSlope, slope, greater);
+			direction = _mm256_blendv_pd(direction, _mm256_set1_pd(codes_[k]), greater);
+		}
+
+		if (noData_.has_value()) {
+			direction = _mm256_blendv_pd(direction, noDataDirection, _mm256_cmp_pd(from, noData, _CMP_EQ_OQ));
+		}
+
+		invalid |= _mm256_movemask_pd(_mm256_cmp_pd(direction, zero, _CMP_EQ_OQ));
+
+		__m128i packed = _mm256_cvttpd_epi32(direction);
+		packed = _mm_packs_epi32(packed, packed);
+		packed = _mm_packs_epi16(packed, packed);
+
+		uint32_t result = (uint32_t)_mm_cvtsi128_si32(packed);
+		memcpy(directions + x, &result, sizeof(result));
+	}
+
+	return invalid | computeScalar(terrain, x, width, width, directions, edges);
+}
\ No newline at end of file
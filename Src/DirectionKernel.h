@@ -0,0 +1,52 @@
+#pragma once
+
+#include <optional>
+#include <cstdint>
+
+class DirectionKernel {
+public:
+	enum class InstructionSet {
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	// Sides of a row whose neighbours are outside of the raster
+	static constexpr int EDGE_TOP = 1;
+	static constexpr int EDGE_BOTTOM = 2;
+	static constexpr int EDGE_LEFT = 4;
+	static constexpr int EDGE_RIGHT = 8;
+
+	// codes are the direction values of the 8 neighbours in scan order (j = -1..1, i = -1..1, center skipped).
+	// Tile rows must be padded with one halo cell on each side, the values of the halo outside the raster aren't read.
+	DirectionKernel(int stride, const int8_t codes[8], std::optional<double> noData, int8_t noDataDirection, InstructionSet instructionSet = detectInstructionSet());
+
+	// Neighbours outside of the raster are taken as slightly lower than the cell, NaN ones inside of it are never picked
+	bool computeRow(const float* terrain, int width, int8_t* directions, int edges);
+
+	// Edges of the row y of a raster, the row spans width cells from x
+	static int getEdges(int x, int y, int width, int rasterWidth, int rasterHeight);
+
+	InstructionSet getInstructionSet();
+
+	static InstructionSet detectInstructionSet();
+	static const char* getInstructionSetName(InstructionSet instructionSet);
+
+private:
+	int computeScalar(const float* terrain, int begin, int end, int width, int8_t* directions, int edges);
+	int computeSSE2(const float* terrain, int width, int8_t* directions, int edges);
+	int computeAVX2(const float* terrain, int width, int8_t* directions, int edges);
+
+	// Neighbours outside of the raster as bits by k, the left and right ones apply to the first and last cell only
+	int getOutside(int x, int width, int edges);
+
+	int offsets_[8]{};
+	int edgeMasks_[4]{}; // By the bit of the edge: top, bottom, left, right
+	double distances_[8]{};
+	int8_t codes_[8]{};
+
+	std::optional<double> noData_;
+	int8_t noDataDirection_ = 0;
+
+	InstructionSet instructionSet_ = InstructionSet::Scalar;
+};
\ No newline at end of file
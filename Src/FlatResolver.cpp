@@ -0,0 +1,344 @@
+#include "pch.h"
+
+#include "FlatResolver.h"
+
+#include <climits>
+
+// Neighbours in scan order, the bits of the equal neighbours masks
+static const int OFFSETS_X[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+static const int OFFSETS_Y[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+
+FlatResolver::FlatResolver(int width, int height, int partsCount, MEMORY_BUDGET budget) : width_(width), height_(height), parts_(partsCount), budget_(budget) {
+	fronts_[0].resize(partsCount);
+	fronts_[1].resize(partsCount);
+}
+
+FlatResolver::~FlatResolver() {
+	budget_->release(acquired_);
+}
+
+uint8_t FlatResolver::getEqualNeighbours(const float* cell, int stride) {
+	uint8_t equalNeighbours = 0;
+
+	for (int k = 0; k < 8; k++) {
+		if (cell[OFFSETS_Y[k] * stride + OFFSETS_X[k]] == *cell) {
+			equalNeighbours |= 1 << k;
+		}
+	}
+
+	return equalNeighbours;
+}
+
+void FlatResolver::push(int part, int x, int y, uint8_t equalNeighbours) {
+	parts_[part].push_back({ x, y, equalNeighbours });
+}
+
+void FlatResolver::prepare() {
+	size_t count = 0;
+
+	for (auto& part : parts_) {
+		count += part.size();
+	}
+
+	size_t size = count * (sizeof(Cell) + sizeof(size_t) + sizeof(uint8_t)) + (size_t(height_) + 1) * sizeof(size_t);
+
+	if (!budget_->acquire(size)) {
+		throw std::runtime_error("FlatResolver: " + std::to_string(count) + " flat cells don't fit into the memory budget!");
+	}
+
+	acquired_ = size;
+
+	rows_.assign(size_t(height_) + 1, 0);
+
+	for (auto& part : parts_) {
+		for (auto& cell : part) {
+			rows_[cell.y + 1]++;
+		}
+	}
+
+	for (int y = 0; y < height_; y++) {
+		rows_[y + 1] += rows_[y];
+	}
+
+	// Bands of the parts interleave, the cells are scattered to their rows. A row comes from a single band so it stays sorted.
+	std::vector<size_t> next(rows_.begin(), rows_.end() - 1);
+
+	cells_.resize(count);
+
+	for (auto& part : parts_) {
+		for (auto& cell : part) {
+			cells_[next[cell.y]++] = cell;
+		}
+
+		part = std::vector<Cell>();
+	}
+
+	// Flats are the components of equal neighbours, order_ doubles as the queue of the labelling
+	std::vector<bool> labelled(count, false);
+
+	order_.reserve(count);
+
+	for (size_t start = 0; start < count; start++) {
+		if (labelled[start]) {
+			continue;
+		}
+
+		flats_.push_back(order_.size());
+
+		labelled[start] = true;
+		order_.push_back(start);
+
+		for (size_t position = flats_.back(); position < order_.size(); position++) {
+			const Cell& cell = cells_[order_[position]];
+
+			for (int k = 0; k < 8; k++) {
+				if (!(cell.equalNeighbours & (1 << k))) {
+					continue;
+				}
+
+				size_t neighbour = find(cell.x + OFFSETS_X[k], cell.y + OFFSETS_Y[k]);
+
+				if (neighbour != NONE && !labelled[neighbour]) {
+					labelled[neighbour] = true;
+					order_.push_back(neighbour);
+				}
+			}
+		}
+	}
+
+	flats_.push_back(order_.size());
+
+	distances_.reset(new std::atomic<uint8_t>[count]());
+
+	nextFlat_ = 0;
+	failed_ = false;
+}
+
+void FlatResolver::resolve(std::shared_ptr<Canvas<uint8_t>>& directions, const int8_t codes[8], int index) {
+	size_t flatsCount = getFlatsCount();
+
+	auto isLarge = [this](size_t flat) {
+		return parts_.size() > 1 && flats_[flat + 1] - flats_[flat] >= LARGE_FLAT;
+	};
+
+	// A single large flat would leave the other threads idle, every thread walks them in the same order
+	for (size_t flat = 0; flat < flatsCount; flat++) {
+		if (isLarge(flat) && !resolveFlat(flat, directions, codes, index, true)) {
+			return;
+		}
+	}
+
+	for (size_t flat = nextFlat_++; flat < flatsCount; flat = nextFlat_++) {
+		if (!isLarge(flat)) {
+			resolveFlat(flat, directions, codes, index, false);
+		}
+	}
+}
+
+size_t FlatResolver::size() {
+	return cells_.size();
+}
+
+size_t FlatResolver::getFlatsCount() {
+	return flats_.empty() ? 0 : flats_.size() - 1;
+}
+
+size_t FlatResolver::find(int x, int y) {
+	if (y < 0 || y >= height_) {
+		return NONE;
+	}
+
+	auto first = cells_.begin() + rows_[y];
+	auto last = cells_.begin() + rows_[y + 1];
+
+	auto cell = std::lower_bound(first, last, x, [](const Cell& cell, int x) {
+		return cell.x < x;
+		});
+
+	return cell != last && cell->x == x ? size_t(cell - cells_.begin()) : NONE;
+}
+
+template<typename IsSeed>
+bool FlatResolver::spread(size_t flat, int shift, int index, bool shared, IsSeed isSeed) {
+	// Shared fronts are the fronts of all the threads joined, each thread takes an equal range of them
+	int first = shared ? 0 : index;
+	int last = shared ? int(parts_.size()) : index + 1;
+	int member = index - first, teamSize = last - first;
+
+	auto sync = [this, shared] {
+		if (shared) {
+			barrier_.wait(int(parts_.size()));
+		}
+	};
+
+	// The last fronts of the previous search are still counted by the others
+	sync();
+
+	size_t begin = flats_[flat];
+	size_t count = flats_[flat + 1] - begin;
+
+	std::vector<size_t>& seeds = fronts_[0][index];
+	seeds.clear();
+
+	for (size_t position = begin + count * member / teamSize; position < begin + count * (member + 1) / teamSize; position++) {
+		size_t cell = order_[position];
+
+		if (isSeed(cells_[cell])) {
+			distances_[cell].fetch_or(uint8_t(2 << shift), std::memory_order_relaxed); // 1 % 3 + 1
+			seeds.push_back(cell);
+		}
+	}
+
+	sync();
+
+	bool seeded = false;
+
+	for (int step = 0;; step++) {
+		auto& front = fronts_[step & 1];
+		auto& next = fronts_[(step + 1) & 1][index];
+
+		size_t total = 0;
+
+		for (int i = first; i < last; i++) {
+			total += front[i].size();
+		}
+
+		if (!total) {
+			break;
+		}
+
+		seeded = true;
+		next.clear();
+
+		// Cells of the front are at step + 1, their neighbours at step + 2
+		uint8_t value = uint8_t(((step + 2) % 3 + 1) << shift);
+		uint8_t mask = uint8_t(3 << shift);
+
+		size_t from = total * member / teamSize, to = total * (member + 1) / teamSize;
+		size_t offset = 0;
+
+		for (int i = first; i < last && offset < to; offset += front[i].size(), i++) {
+			for (size_t j = from > offset ? from - offset : 0; j < front[i].size() && offset + j < to; j++) {
+				const Cell& cell = cells_[front[i][j]];
+
+				for (int k = 0; k < 8; k++) {
+					if (!(cell.equalNeighbours & (1 << k))) {
+						continue;
+					}
+
+					size_t neighbour = find(cell.x + OFFSETS_X[k], cell.y + OFFSETS_Y[k]);
+
+					if (neighbour == NONE) {
+						continue;
+					}
+
+					// Claimed once even if the cell is in the ranges of several threads
+					uint8_t distances = distances_[neighbour].load(std::memory_order_relaxed);
+
+					while (!(distances & mask)) {
+						if (distances_[neighbour].compare_exchange_weak(distances, distances | value, std::memory_order_relaxed)) {
+							next.push_back(neighbour);
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		sync();
+	}
+
+	return seeded;
+}
+
+bool FlatResolver::resolveFlat(size_t flat, std::shared_ptr<Canvas<uint8_t>>& directions, const int8_t codes[8], int index, bool shared) {
+	// Outlets are the neighbours of the same elevation that already drain, higher ones are all the others
+	bool outlets = spread(flat, 0, index, shared, [this](const Cell& cell) {
+		for (int k = 0; k < 8; k++) {
+			if ((cell.equalNeighbours & (1 << k)) && find(cell.x + OFFSETS_X[k], cell.y + OFFSETS_Y[k]) == NONE) {
+				return true;
+			}
+		}
+
+		return false;
+		});
+
+	if (!outlets) {
+		throw std::runtime_error("FlowDirection: Flat without outlet, fill depressions first!");
+	}
+
+	bool higher = spread(flat, 2, index, shared, [](const Cell& cell) {
+		return cell.equalNeighbours != 0xFF;
+		});
+
+	// The mask is 2 * towards + (the largest away - away). Stepping towards the outlets lowers it by 2, the away
+	// gradient changes it by 1 at most, so every cell has a lower neighbour. Outlets are below any cell of the flat.
+	auto getStep = [](uint8_t from, uint8_t to) {
+		static const int STEPS[3] = { 0, 1, -1 };
+
+		return STEPS[(to - from + 3) % 3];
+	};
+
+	int first = shared ? 0 : index;
+	int member = index - first, teamSize = shared ? int(parts_.size()) : 1;
+
+	size_t begin = flats_[flat];
+	size_t count = flats_[flat + 1] - begin;
+
+	std::exception_ptr failure;
+
+	try {
+		for (size_t position = begin + count * member / teamSize; position < begin + count * (member + 1) / teamSize; position++) {
+			size_t cell = order_[position];
+			const Cell& flatCell = cells_[cell];
+
+			uint8_t distances = distances_[cell].load(std::memory_order_relaxed);
+
+			int lowest = 0;
+			int8_t direction = 0;
+
+			for (int k = 0; k < 8; k++) {
+				if (!(flatCell.equalNeighbours & (1 << k))) {
+					continue;
+				}
+
+				size_t neighbour = find(flatCell.x + OFFSETS_X[k], flatCell.y + OFFSETS_Y[k]);
+				int step = INT_MIN;
+
+				if (neighbour != NONE) {
+					uint8_t neighbourDistances = distances_[neighbour].load(std::memory_order_relaxed);
+
+					step = 2 * getStep(distances & 3, neighbourDistances & 3) - (higher ? getStep(distances >> 2, neighbourDistances >> 2) : 0);
+				}
+
+				if (step < lowest) {
+					lowest = step;
+					direction = codes[k];
+				}
+			}
+
+			directions->at(flatCell.x, flatCell.y, index) = uint8_t(direction);
+		}
+	}
+	catch (...) {
+		if (!shared) {
+			throw;
+		}
+
+		failure = std::current_exception();
+		failed_ = true;
+	}
+
+	// The others stop at the same flat instead of waiting for the failed thread
+	if (shared) {
+		barrier_.wait(int(parts_.size()));
+
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
+
+		return !failed_;
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Barrier.h"
+#include "Canvas.h"
+
+// Drains the cells left without a downslope neighbour across their flats (Barnes, Lehman, Mulla 2014). Each flat gets
+// a gradient towards its outlets combined with a weaker one away from its higher border, both built front by front.
+// Only the flat cells are kept, sorted by rows, the canvas is touched just to write their directions.
+class FlatResolver {
+public:
+	// Each of the partsCount threads pushes its own part and all of them resolve the flats together
+	FlatResolver(int width, int height, int partsCount, MEMORY_BUDGET budget);
+	~FlatResolver();
+
+	// Bit k is set for the k-th neighbour in scan order having the elevation of the cell. Rows padded as for DirectionKernel
+	static uint8_t getEqualNeighbours(const float* cell, int stride);
+
+	// Cells of a part in row-major order within bands of whole rows, the bands of the parts may interleave
+	void push(int part, int x, int y, uint8_t equalNeighbours);
+
+	// Joins the parts and labels the flats, called once by a single thread after every part is complete. Throws if
+	// the flat cells don't fit into the budget.
+	void prepare();
+
+	// Called by every thread of the parts. Large flats are resolved by all of them at once, each front of the searches
+	// split between the threads, the others are taken from a shared counter. codes are the direction values as for
+	// DirectionKernel.
+	void resolve(std::shared_ptr<Canvas<uint8_t>>& directions, const int8_t codes[8], int index);
+
+	size_t size();
+	size_t getFlatsCount();
+
+private:
+	static const size_t NONE = ~size_t(0);
+	static const size_t LARGE_FLAT = 64 * 1024; // Cells
+
+	struct Cell {
+		int x;
+		int y;
+		uint8_t equalNeighbours;
+	};
+
+	size_t find(int x, int y);
+
+	// Breadth-first distances over the flat starting at 1 from its seeds into the bits at shift, returns false without
+	// seeds. Shared by all the threads or run by the calling one alone.
+	template<typename IsSeed>
+	bool spread(size_t flat, int shift, int index, bool shared, IsSeed isSeed);
+
+	// Returns false if another thread sharing the flat failed
+	bool resolveFlat(size_t flat, std::shared_ptr<Canvas<uint8_t>>& directions, const int8_t codes[8], int index, bool shared);
+
+	int width_ = 0;
+	int height_ = 0;
+
+	std::vector<std::vector<Cell>> parts_;
+
+	std::vector<Cell> cells_;
+	std::vector<size_t> rows_; // First cell of every row, height + 1 of them
+
+	std::vector<size_t> order_; // Cells grouped by flat
+	std::vector<size_t> flats_; // First position of every flat in order_, flats count + 1 of them
+
+	// Distances towards the outlets in the low 2 bits, away from the higher border in the next 2, both kept as
+	// distance % 3 + 1 with 0 for not reached. Neighbours in a flat differ by 1 at most, so that's enough to compare them.
+	std::unique_ptr<std::atomic<uint8_t>[]> distances_;
+
+	std::vector<std::vector<size_t>> fronts_[2]; // Current and next fronts of every thread
+
+	std::atomic<size_t> nextFlat_{ 0 };
+
+	Barrier barrier_;
+	std::atomic_bool failed_{ false };
+
+	MEMORY_BUDGET budget_;
+	size_t acquired_ = 0;
+};
\ No newline at end of file
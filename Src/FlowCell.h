@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// A cell of the directions raster shared by both phases: the D8 code in the low nibble and the number of
+// upstream neighbours in the high one, counted off by the accumulation walkers. Confluences are cells with more than one.
+struct FlowCell {
+	static const uint8_t NO_DATA = 5; // The center code, never a direction
+	static const uint8_t IN_DEGREE_ONE = 1 << 4;
+
+	static int getDirection(uint8_t cell) {
+		return cell & 0x0F;
+	}
+
+	static int getInDegree(uint8_t cell) {
+		return cell >> 4;
+	}
+
+	static uint8_t make(int direction, int inDegree) {
+		return uint8_t(direction | inDegree << 4);
+	}
+};
\ No newline at end of file
@@ -7,7 +7,36 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 
-GdalRasterBand::GdalRasterBand(void* rasterBand, bool ints64) : rasterBand_(rasterBand), ints64_(ints64) {
+#include "Statistics.h"
+
+static GDALDataType getGdalDataType(RasterDataType dataType) {
+	switch (dataType) {
+	case RasterDataType::UInt32:
+		return GDT_UInt32;
+	case RasterDataType::Float32:
+		return GDT_Float32;
+	default:
+		return GDT_Int8;
+	}
+}
+
+// Bytes of the buffers moved by successful reads and writes
+static int countBytes(int error, int xBufferSize, int yBufferSize, int cellSize, bool written) {
+	if (!error) {
+		size_t bytes = size_t(xBufferSize) * yBufferSize * cellSize;
+
+		if (written) {
+			Statistics::getInstance().addWritten(bytes);
+		}
+		else {
+			Statistics::getInstance().addRead(bytes);
+		}
+	}
+
+	return error;
+}
+
+GdalRasterBand::GdalRasterBand(void* rasterBand, RasterDataType dataType) : rasterBand_(rasterBand), dataType_(dataType) {
 	if (!rasterBand) {
 		throw std::runtime_error("Empty raster band.");
 	}
@@ -57,71 +86,77 @@ int GdalRasterBand::getBand() {
 	return rasterBand->GetBand();
 }
 
+void GdalRasterBand::getBlockSize(int* xSize, int* ySize) {
+	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
+
+	rasterBand->GetBlockSize(xSize, ySize);
+}
+
 int GdalRasterBand::rasterByte(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
 	std::unique_lock<std::mutex> lock;
 	if (!rasterBand->GetDataset()->IsThreadSafe(GDAL_OF_RASTER)) {
-		lock = std::unique_lock(mutex_);
+		lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 	}
 
-	return rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Int8, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Int8, 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(GDT_Int8), false);
 }
 
 int GdalRasterBand::rasterInt(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
 	std::unique_lock<std::mutex> lock;
 	if (!rasterBand->GetDataset()->IsThreadSafe(GDAL_OF_RASTER)) {
-		lock = std::unique_lock(mutex_);
+		lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 	}
 
-	return rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Int32, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Int32, 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(GDT_Int32), false);
 }
 
 int GdalRasterBand::rasterUInt32(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
 	std::unique_lock<std::mutex> lock;
 	if (!rasterBand->GetDataset()->IsThreadSafe(GDAL_OF_RASTER)) {
-		lock = std::unique_lock(mutex_);
+		lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 	}
 
-	return rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_UInt32, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_UInt32, 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(GDT_UInt32), false);
 }
 
 int GdalRasterBand::rasterUInt64(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
 	std::unique_lock<std::mutex> lock;
 	if (!rasterBand->GetDataset()->IsThreadSafe(GDAL_OF_RASTER)) {
-		lock = std::unique_lock(mutex_);
+		lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 	}
 
-	return rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_UInt64, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_UInt64, 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(GDT_UInt64), false);
 }
 
 int GdalRasterBand::rasterFloat(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
 	std::unique_lock<std::mutex> lock;
 	if (!rasterBand->GetDataset()->IsThreadSafe(GDAL_OF_RASTER)) {
-		lock = std::unique_lock(mutex_);
+		lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 	}
 
-	return rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Float32, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Float32, 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(GDT_Float32), false);
 }
 
 int GdalRasterBand::rasterDouble(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
 	std::unique_lock<std::mutex> lock;
 	if (!rasterBand->GetDataset()->IsThreadSafe(GDAL_OF_RASTER)) {
-		lock = std::unique_lock(mutex_);
+		lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 	}
 
-	return rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Float64, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Read, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, GDT_Float64, 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(GDT_Float64), false);
 }
 
 int GdalRasterBand::raster(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
 	GDALRasterBand* rasterBand = (GDALRasterBand*)rasterBand_;
-	std::unique_lock lock(mutex_);
+	auto lock = Statistics::lock(mutex_, WaitPoint::Gdal);
 
-	return rasterBand->RasterIO(GF_Write, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, ints64_ ? GDT_UInt32 : GDT_Int8, 0, 0);
+	return countBytes(rasterBand->RasterIO(GF_Write, offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize, getGdalDataType(dataType_), 0, 0), xBufferSize, yBufferSize, GDALGetDataTypeSizeBytes(getGdalDataType(dataType_)), true);
 }
 
 std::optional<double> GdalRasterBand::getNoDataValue() {
@@ -139,18 +174,46 @@ int GdalRasterBand::setNoDataValue(double value) {
 	return rasterBand->SetNoDataValue(value);
 }
 
-GdalTiffReader::GdalTiffReader(const std::string& fileName) {
+GdalTiffReader::GdalTiffReader(const std::string& fileName, bool update) {
 	GDALAllRegister();
-	gdalDataset_ = GDALDataset::Open(fileName.data(), GDAL_OF_READONLY | GDAL_OF_RASTER | GDAL_OF_THREAD_SAFE);
+	gdalDataset_ = GDALDataset::Open(fileName.data(), update ? GDAL_OF_UPDATE | GDAL_OF_RASTER : GDAL_OF_READONLY | GDAL_OF_RASTER | GDAL_OF_THREAD_SAFE);
 	GDALDataset* poDataset = (GDALDataset*)gdalDataset_;
+
+	// Rasters of previous runs opened for update are written back in their own type
+	if (poDataset && poDataset->GetRasterCount()) {
+		switch (poDataset->GetRasterBand(1)->GetRasterDataType()) {
+		case GDT_UInt32:
+			dataType_ = RasterDataType::UInt32;
+			break;
+		case GDT_Float32:
+			dataType_ = RasterDataType::Float32;
+			break;
+		default:
+			break;
+		}
+	}
 }
 
-GdalTiffReader::GdalTiffReader(const std::string& fileName, int sizeX, int sizeY, int bandCount, bool ints64) : ints64_(ints64) {
-	/*options_ = CSLSetNameValue(options_, "TILED", "YES");
-	options_ = CSLSetNameValue(options_, "COMPRESS", "PACKBITS");*/
+GdalTiffReader::GdalTiffReader(const std::string& fileName, int sizeX, int sizeY, int bandCount, RasterDataType dataType, const CreationProfile& profile) : dataType_(dataType) {
+	if (profile.blockSize) {
+		std::string blockSize = std::to_string(profile.blockSize);
+
+		options_ = CSLSetNameValue(options_, "TILED", "YES");
+		options_ = CSLSetNameValue(options_, "BLOCKXSIZE", blockSize.data());
+		options_ = CSLSetNameValue(options_, "BLOCKYSIZE", blockSize.data());
+	}
+
+	if (!profile.compression.empty()) {
+		std::string threads = profile.threads ? std::to_string(profile.threads) : "ALL_CPUS";
+
+		options_ = CSLSetNameValue(options_, "COMPRESS", profile.compression.data());
+		options_ = CSLSetNameValue(options_, "PREDICTOR", "2"); // Horizontal differencing, the rasters are integer
+		options_ = CSLSetNameValue(options_, "NUM_THREADS", threads.data());
+	}
+
 	options_ = CSLSetNameValue(options_, "BIGTIFF", "YES");
 	GDALDriver* poDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
-	gdalDataset_ = poDriver->Create(fileName.data(), sizeX, sizeY, bandCount, ints64 ? GDT_UInt32 : GDT_Int8, options_);
+	gdalDataset_ = poDriver->Create(fileName.data(), sizeX, sizeY, bandCount, getGdalDataType(dataType), options_);
 }
 
 GdalTiffReader::~GdalTiffReader() {
@@ -162,7 +225,7 @@ GdalTiffReader::~GdalTiffReader() {
 }
 
 GdalRasterBand* GdalTiffReader::getRasterBand(int num) {
-	return new GdalRasterBand(GDALDataset::FromHandle(gdalDataset_)->GetRasterBand(num), ints64_);
+	return new GdalRasterBand(GDALDataset::FromHandle(gdalDataset_)->GetRasterBand(num), dataType_);
 }
 
 int GdalTiffReader::getRasterCount() {
@@ -187,4 +250,14 @@ std::vector<double> GdalTiffReader::getGeoTransform() {
 
 void GdalTiffReader::setGeoTransform(const std::vector<double>& geoTransform) {
 	GDALDataset::FromHandle(gdalDataset_)->SetGeoTransform((double*)geoTransform.data());
+}
+
+std::string GdalTiffReader::getMetadataItem(const std::string& name) {
+	const char* value = GDALDataset::FromHandle(gdalDataset_)->GetMetadataItem(name.c_str());
+
+	return value ? value : "";
+}
+
+void GdalTiffReader::setMetadataItem(const std::string& name, const std::string& value) {
+	GDALDataset::FromHandle(gdalDataset_)->SetMetadataItem(name.c_str(), value.c_str());
 }
\ No newline at end of file
@@ -6,9 +6,15 @@
 
 #include "IGeoTiffReader.h"
 
+enum class RasterDataType {
+	Int8,
+	UInt32,
+	Float32
+};
+
 class GdalRasterBand : public IRasterBand {
 public:
-	GdalRasterBand(void* rasterBand, bool ints64);
+	GdalRasterBand(void* rasterBand, RasterDataType dataType);
 	~GdalRasterBand();
 
 	int rasterByte(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
@@ -23,6 +29,7 @@ public:
 	int getXSize();
 	int getYSize();
 	int getBand();
+	void getBlockSize(int* xSize, int* ySize);
 
 	std::optional<double> getNoDataValue();
 	int setNoDataValue(double value);
@@ -34,13 +41,19 @@ public:
 private:
 	std::mutex mutex_;
 	void* rasterBand_ = nullptr;
-	bool ints64_ = false;
+	RasterDataType dataType_ = RasterDataType::Int8; // Written by raster()
+};
+
+struct CreationProfile {
+	int blockSize = 0; // Strips if zero
+	std::string compression; // DEFLATE, ZSTD, LZW, uncompressed if empty
+	int threads = 0; // Compression threads, all CPUs if zero
 };
 
 class GdalTiffReader : public IGeoTiffReader {
 public:
-	GdalTiffReader(const std::string& fileName);
-	GdalTiffReader(const std::string& fileName, int sizeX, int sizeY, int bandCount, bool ints64 = false);
+	GdalTiffReader(const std::string& fileName, bool update = false);
+	GdalTiffReader(const std::string& fileName, int sizeX, int sizeY, int bandCount, RasterDataType dataType = RasterDataType::Int8, const CreationProfile& profile = CreationProfile());
 	~GdalTiffReader();
 
 	GdalRasterBand* getRasterBand(int num);
@@ -52,8 +65,11 @@ public:
 	std::vector<double> getGeoTransform();
 	void setGeoTransform(const std::vector<double>& geoTransform);
 
+	std::string getMetadataItem(const std::string& name);
+	void setMetadataItem(const std::string& name, const std::string& value);
+
 private:
 	char** options_ = nullptr;
 	void* gdalDataset_ = nullptr;
-	bool ints64_ = false;
+	RasterDataType dataType_ = RasterDataType::Int8;
 };
\ No newline at end of file
@@ -18,6 +18,7 @@ public:
 	virtual int getXSize() = 0;
 	virtual int getYSize() = 0;
 	virtual int getBand() = 0;
+	virtual void getBlockSize(int* xSize, int* ySize) = 0;
 
 	virtual std::optional<double> getNoDataValue() = 0;
 	virtual int setNoDataValue(double value) = 0;
@@ -37,4 +38,8 @@ public:
 
 	virtual std::vector<double> getGeoTransform() = 0;
 	virtual void setGeoTransform(const std::vector<double>& geoTransform) = 0;
+
+	// Dataset metadata of the default domain, empty if the item is missing
+	virtual std::string getMetadataItem(const std::string& name) = 0;
+	virtual void setMetadataItem(const std::string& name, const std::string& value) = 0;
 };
\ No newline at end of file
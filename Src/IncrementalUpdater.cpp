@@ -0,0 +1,151 @@
+#include "pch.h"
+
+#include "IncrementalUpdater.h"
+
+#include <vector>
+
+#include "DirectionKernel.h"
+#include "FlowCell.h"
+
+IncrementalUpdater::IncrementalUpdater(RASTER_BAND terrain, RASTER_BAND directions, RASTER_BAND accumulation, MEMORY_BUDGET budget) : terrain_(terrain) {
+	width_ = terrain->getXSize();
+	height_ = terrain->getYSize();
+
+	if (directions->getXSize() != width_ || directions->getYSize() != height_ || accumulation->getXSize() != width_ || accumulation->getYSize() != height_) {
+		throw std::runtime_error("Incremental: Rasters of the previous run don't match the terrain!");
+	}
+
+	// Statistics of the previous run are kept, computing them again would read both rasters whatever the edit is
+	directions_.reset(new Canvas<uint8_t>(directions, true, budget, 0, 0, false));
+	accumulation_.reset(new Canvas<uint32_t>(accumulation, true, budget, 0, 0, false));
+
+	for (int j = -1, k = 0; j <= 1; j++) {
+		for (int i = -1; i <= 1; i++) {
+			if (i != 0 || j != 0) {
+				codes_[k++] = (j + 1) * 3 + (i + 1) + 1;
+			}
+		}
+	}
+}
+
+void IncrementalUpdater::update(int x, int y, int width, int height) {
+	// The window with the halo of cells whose directions depend on it
+	int left = max(x - 1, 0), right = min(x + width + 1, width_);
+	int top = max(y - 1, 0), bottom = min(y + height + 1, height_);
+
+	if (left >= right || top >= bottom) {
+		throw std::runtime_error("Incremental: Window is outside of the raster!");
+	}
+
+	int regionWidth = right - left;
+	int regionHeight = bottom - top;
+
+	// The region with a halo cell around, NaN outside of the raster
+	int stride = regionWidth + 2;
+	int readLeft = max(left - 1, 0), readRight = min(right + 1, width_);
+	int readTop = max(top - 1, 0), readBottom = min(bottom + 1, height_);
+
+	std::vector<float> read(size_t(readRight - readLeft) * (readBottom - readTop));
+	std::vector<float> terrain(size_t(stride) * (regionHeight + 2), std::numeric_limits<float>::quiet_NaN());
+
+	if (terrain_->rasterFloat(readLeft, readTop, readRight - readLeft, readBottom - readTop, read.data(), readRight - readLeft, readBottom - readTop)) {
+		throw std::runtime_error("Incremental: Failed to read terrain!");
+	}
+
+	for (int row = 0; row < readBottom - readTop; row++) {
+		std::copy_n(read.data() + size_t(row) * (readRight - readLeft), readRight - readLeft, terrain.data() + size_t(row + readTop - (top - 1)) * stride + readLeft - (left - 1));
+	}
+
+	DirectionKernel kernel(stride, codes_, terrain_->getNoDataValue(), FlowCell::NO_DATA);
+
+	std::vector<int8_t> directions(regionWidth);
+	std::vector<Change> changes;
+
+	for (int row = 0; row < regionHeight; row++) {
+		const float* terrainRow = terrain.data() + size_t(row + 1) * stride + 1;
+
+		kernel.computeRow(terrainRow, regionWidth, directions.data(), DirectionKernel::getEdges(left, top + row, regionWidth, width_, height_));
+
+		for (int column = 0; column < regionWidth; column++) {
+			int cellX = left + column, cellY = top + row;
+
+			int previous = FlowCell::getDirection(directions_->at(cellX, cellY));
+			int direction = directions[column];
+
+			if ((previous == FlowCell::NO_DATA) != (direction == FlowCell::NO_DATA)) {
+				throw std::runtime_error("Incremental: Nodata cells changed, rerun the full process!");
+			}
+
+			// A resolved flat keeps its direction as long as it still leads to a cell of the same height
+			if (!direction) {
+				int i = (previous - 1) % 3 - 1, j = (previous - 1) / 3 - 1;
+
+				if (previous && terrainRow[column + j * stride + i] == terrainRow[column]) {
+					direction = previous;
+				}
+				else {
+					throw std::runtime_error("Incremental: The edit leaves a flat, rerun the full process!");
+				}
+			}
+
+			if (direction != previous) {
+				changes.push_back({ cellX, cellY, int8_t(direction) });
+			}
+		}
+	}
+
+	changed_ += changes.size();
+
+	// Detached cells end their paths, so no intermediate graph has a cycle if the final one hasn't
+	for (auto& change : changes) {
+		int previous = FlowCell::getDirection(directions_->at(change.x, change.y));
+		directions_->at(change.x, change.y) = uint8_t(0);
+
+		propagate(change.x, change.y, previous, uint32_t(0) - accumulation_->at(change.x, change.y));
+	}
+
+	for (auto& change : changes) {
+		directions_->at(change.x, change.y) = uint8_t(change.direction);
+
+		propagate(change.x, change.y, change.direction, accumulation_->at(change.x, change.y));
+	}
+
+	directions_->flush();
+	accumulation_->flush();
+}
+
+size_t IncrementalUpdater::getChangedCount() {
+	return changed_;
+}
+
+size_t IncrementalUpdater::getVisitedCount() {
+	return visited_;
+}
+
+void IncrementalUpdater::propagate(int x, int y, int direction, uint32_t amount) {
+	size_t steps = 0;
+
+	while (direction) {
+		x += (direction - 1) % 3 - 1;
+		y += (direction - 1) / 3 - 1;
+
+		auto cell = directions_->at(x, y);
+		if (!cell.valid()) {
+			break;
+		}
+
+		direction = FlowCell::getDirection(cell);
+		if (direction == FlowCell::NO_DATA) {
+			break;
+		}
+
+		auto data = accumulation_->at(x, y);
+		data = uint32_t(data + amount);
+
+		if (++steps > size_t(width_) * height_) {
+			throw std::runtime_error("Incremental: Directions have a cycle!");
+		}
+	}
+
+	visited_ += steps;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Canvas.h"
+
+// Updates the directions and the accumulation of a previous run in place after a local edit of the terrain.
+// Directions are computed again in the edited window with a one-cell halo. Cells whose direction changed move their
+// accumulation from the old downstream path to the new one. All of them are detached first and then attached, so every
+// intermediate graph is part of the final acyclic one. The work is proportional to the window and the paths below it.
+class IncrementalUpdater {
+public:
+	// directions hold the D8 codes of the previous run, both rasters are opened for update
+	IncrementalUpdater(RASTER_BAND terrain, RASTER_BAND directions, RASTER_BAND accumulation, MEMORY_BUDGET budget);
+
+	void update(int x, int y, int width, int height);
+
+	size_t getChangedCount();
+	size_t getVisitedCount();
+
+private:
+	struct Change {
+		int x;
+		int y;
+		int8_t direction;
+	};
+
+	// Adds amount to every cell downstream of the one the direction leads to from x, y
+	void propagate(int x, int y, int direction, uint32_t amount);
+
+	RASTER_BAND terrain_;
+	int width_ = 0;
+	int height_ = 0;
+
+	std::shared_ptr<Canvas<uint8_t>> directions_;
+	std::shared_ptr<Canvas<uint32_t>> accumulation_;
+
+	int8_t codes_[8]{};
+
+	size_t changed_ = 0;
+	size_t visited_ = 0;
+};
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "pch.h"
+
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+#ifdef _WIN32
+	file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file_ == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("MappedFile: Failed to open file!");
+	}
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file_, &size)) {
+		CloseHandle(file_);
+
+		throw std::runtime_error("MappedFile: Failed to get file size!");
+	}
+
+	size_ = size_t(size.QuadPart);
+
+	// Empty files can't be mapped
+	if (!size_) {
+		return;
+	}
+
+	mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data_ = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	if (!data_) {
+		if (mapping_) {
+			CloseHandle(mapping_);
+		}
+
+		CloseHandle(file_);
+
+		throw std::runtime_error("MappedFile: Failed to map file!");
+	}
+#else
+	file_ = open(path.c_str(), O_RDONLY);
+
+	if (file_ == -1) {
+		throw std::runtime_error("MappedFile: Failed to open file!");
+	}
+
+	struct stat info;
+
+	if (fstat(file_, &info)) {
+		close(file_);
+
+		throw std::runtime_error("MappedFile: Failed to get file size!");
+	}
+
+	size_ = size_t(info.st_size);
+
+	// Empty files can't be mapped
+	if (!size_) {
+		return;
+	}
+
+	void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file_, 0);
+
+	if (data == MAP_FAILED) {
+		close(file_);
+
+		throw std::runtime_error("MappedFile: Failed to map file!");
+	}
+
+	madvise(data, size_, MADV_SEQUENTIAL);
+	data_ = data;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (data_) {
+		UnmapViewOfFile(data_);
+	}
+
+	if (mapping_) {
+		CloseHandle(mapping_);
+	}
+
+	if (file_ != INVALID_HANDLE_VALUE) {
+		CloseHandle(file_);
+	}
+#else
+	if (data_) {
+		munmap(const_cast<void*>(data_), size_);
+	}
+
+	if (file_ != -1) {
+		close(file_);
+	}
+#endif
+}
+
+const void* MappedFile::data() {
+	return data_;
+}
+
+size_t MappedFile::size() {
+	return size_;
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <filesystem>
+
+// Read-only view of a whole file mapped into memory
+class MappedFile {
+public:
+	MappedFile(const std::filesystem::path& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const void* data();
+	size_t size();
+
+private:
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#else
+	int file_ = -1;
+#endif
+
+	const void* data_ = nullptr;
+	size_t size_ = 0;
+};
\ No newline at end of file
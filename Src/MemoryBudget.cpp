@@ -0,0 +1,94 @@
+#include "pch.h"
+
+#include "MemoryBudget.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+MemoryBudget::MemoryBudget(size_t limit) : limit_(limit) {
+
+}
+
+bool MemoryBudget::acquire(size_t bytes, bool force) {
+	size_t used = used_.load(std::memory_order_relaxed);
+
+	do {
+		if (!force && used + bytes > limit_) {
+			return false;
+		}
+	} while (!used_.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+
+	return true;
+}
+
+void MemoryBudget::release(size_t bytes) {
+	used_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t MemoryBudget::getLimit() {
+	return limit_;
+}
+
+size_t MemoryBudget::getUsed() {
+	return used_.load(std::memory_order_relaxed);
+}
+
+size_t MemoryBudget::getAvailableMemory() {
+#ifdef _WIN32
+	MEMORYSTATUSEX memory{};
+	memory.dwLength = sizeof(memory);
+
+	if (!GlobalMemoryStatusEx(&memory)) {
+		return 4ll * 1024 * 1024 * 1024;
+	}
+
+	return size_t(memory.ullAvailPhys * 0.8);
+#else
+	// MemAvailable counts the reclaimable page cache as well, as the Windows figure does
+	std::ifstream meminfo("/proc/meminfo");
+	std::string key;
+	size_t kilobytes;
+
+	while (meminfo >> key >> kilobytes) {
+		if (key == "MemAvailable:") {
+			return size_t(kilobytes * 1024 * 0.8);
+		}
+
+		meminfo.ignore(64, '\n');
+	}
+
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+
+	if (pages <= 0) {
+		return 4ll * 1024 * 1024 * 1024;
+	}
+
+	return size_t(pages * sysconf(_SC_PAGESIZE) * 0.8);
+#endif
+}
+
+size_t MemoryBudget::getPeakWorkingSet() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage{};
+
+	if (getrusage(RUSAGE_SELF, &usage)) {
+		return 0;
+	}
+
+	return size_t(usage.ru_maxrss) * 1024; // Kilobytes on Linux
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+class MemoryBudget {
+public:
+	MemoryBudget(size_t limit);
+
+	// Reserves bytes if they fit into the limit, force reserves them anyway
+	bool acquire(size_t bytes, bool force = false);
+	void release(size_t bytes);
+
+	size_t getLimit();
+	size_t getUsed();
+
+	static size_t getAvailableMemory();
+	static size_t getPeakWorkingSet();
+
+private:
+	size_t limit_ = 0;
+	std::atomic_size_t used_ = 0;
+};
+
+typedef std::shared_ptr<MemoryBudget> MEMORY_BUDGET;
\ No newline at end of file
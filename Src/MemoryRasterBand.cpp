@@ -0,0 +1,140 @@
+#include "pch.h"
+
+#include "MemoryRasterBand.h"
+
+#include <cstring>
+#include <limits>
+
+// Same values as CPLErr, the GDAL bands return them
+static const int NONE = 0;
+static const int FAILURE = 3;
+
+template<typename T>
+MemoryRasterBand<T>::MemoryRasterBand(int xSize, int ySize) : data_(size_t(xSize) * ySize), xSize_(xSize), ySize_(ySize) {
+
+}
+
+template<typename T>
+bool MemoryRasterBand<T>::isWindowValid(int offsetX, int offsetY, int xSize, int ySize, int xBufferSize, int yBufferSize) {
+	// No resampling, the buffer has to match the window
+	return offsetX >= 0 && offsetY >= 0 && xSize >= 0 && ySize >= 0 && offsetX + xSize <= xSize_ && offsetY + ySize <= ySize_ && xSize == xBufferSize && ySize == yBufferSize;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::read(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	if (!isWindowValid(offsetX, offsetY, xSize, ySize, xBufferSize, yBufferSize)) {
+		return FAILURE;
+	}
+
+	for (int y = 0; y < ySize; y++) {
+		memcpy((T*)buffer + size_t(y) * xSize, data_.data() + size_t(offsetY + y) * xSize_ + offsetX, xSize * sizeof(T));
+	}
+
+	return NONE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::rasterByte(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	return std::is_same_v<T, int8_t> ? read(offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize) : FAILURE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::rasterInt(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	return FAILURE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::rasterUInt32(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	return FAILURE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::rasterUInt64(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	return FAILURE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::rasterFloat(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	return std::is_same_v<T, float> ? read(offsetX, offsetY, xSize, ySize, buffer, xBufferSize, yBufferSize) : FAILURE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::rasterDouble(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	return FAILURE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::raster(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize) {
+	if (!isWindowValid(offsetX, offsetY, xSize, ySize, xBufferSize, yBufferSize)) {
+		return FAILURE;
+	}
+
+	for (int y = 0; y < ySize; y++) {
+		memcpy(data_.data() + size_t(offsetY + y) * xSize_ + offsetX, (const T*)buffer + size_t(y) * xSize, xSize * sizeof(T));
+	}
+
+	return NONE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::getXSize() {
+	return xSize_;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::getYSize() {
+	return ySize_;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::getBand() {
+	return 1;
+}
+
+template<typename T>
+void MemoryRasterBand<T>::getBlockSize(int* xSize, int* ySize) {
+	// Any window is as cheap as another
+	*xSize = 1;
+	*ySize = 1;
+}
+
+template<typename T>
+std::optional<double> MemoryRasterBand<T>::getNoDataValue() {
+	return noData_;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::setNoDataValue(double value) {
+	noData_ = value;
+
+	return NONE;
+}
+
+template<typename T>
+std::pair<double, double> MemoryRasterBand<T>::getRasterMinMax(bool approx) {
+	std::pair<double, double> minMax((std::numeric_limits<double>::max)(), std::numeric_limits<double>::lowest());
+
+	for (T value : data_) {
+		if (noData_.has_value() && value == noData_.value()) {
+			continue;
+		}
+
+		minMax.first = min(minMax.first, double(value));
+		minMax.second = max(minMax.second, double(value));
+	}
+
+	return minMax;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::setStatistics(double min, double max, double mean, double stdDev) {
+	return NONE;
+}
+
+template<typename T>
+int MemoryRasterBand<T>::computeRasterMinMax() {
+	return NONE; // Nobody reads statistics of a band that never reaches a file
+}
+
+template class MemoryRasterBand<int8_t>;
+template class MemoryRasterBand<float>;
\ No newline at end of file
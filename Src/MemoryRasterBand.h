@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "IGeoTiffReader.h"
+
+// Band kept in RAM, for temp rasters shared between the stages without a round trip through a file.
+// Threads may read and write disjoint windows concurrently. Only T is read, raster() writes T.
+template<typename T>
+class MemoryRasterBand : public IRasterBand {
+public:
+	MemoryRasterBand(int xSize, int ySize);
+
+	int rasterByte(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+	int rasterInt(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+	int rasterUInt32(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+	int rasterUInt64(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+	int rasterFloat(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+	int rasterDouble(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+
+	int raster(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+
+	int getXSize();
+	int getYSize();
+	int getBand();
+	void getBlockSize(int* xSize, int* ySize);
+
+	std::optional<double> getNoDataValue();
+	int setNoDataValue(double value);
+
+	std::pair<double, double> getRasterMinMax(bool approx = true);
+	int setStatistics(double min, double max, double mean, double stdDev);
+	int computeRasterMinMax();
+
+private:
+	bool isWindowValid(int offsetX, int offsetY, int xSize, int ySize, int xBufferSize, int yBufferSize);
+	int read(int offsetX, int offsetY, int xSize, int ySize, void* buffer, int xBufferSize, int yBufferSize);
+
+	std::vector<T> data_;
+
+	int xSize_ = 0;
+	int ySize_ = 0;
+
+	std::optional<double> noData_;
+};
\ No newline at end of file
@@ -2,10 +2,21 @@
 
 #include "Plugin.h"
 
-#include <queue>
 #include <fstream>
+#include <future>
+#include <cmath>
+#include <cstring>
 
+#include "ArtifactCache.h"
 #include "Barrier.h"
+#include "ChunkScheduler.h"
+#include "DepressionFiller.h"
+#include "DirectionKernel.h"
+#include "IncrementalUpdater.h"
+#include "MemoryRasterBand.h"
+#include "Statistics.h"
+#include "TiledAccumulator.h"
+#include "TileJob.h"
 #include "Timer.h"
 
 int Plugin::getDirection(int i, int j) {
@@ -19,10 +30,33 @@ void Plugin::getOffsets(int direction, int* i, int* j) {
 	*j = direction / 3 - 1;
 }
 
-int Plugin::calculateFlowDirection(CANVAS_FLOAT& terrain, int x, int y, int index) {
-	auto from = terrain->at(x, y, index);
-	double maxSlope = 0;
-	int direction = 0;
+void Plugin::readTerrainTile(RASTER_BAND& terrainBand, int width, int height, int rowOffset, int rows, std::vector<float>& tile) {
+	int stride = width + 2;
+	int top = max(rowOffset - 1, 0);
+	int bottom = min(rowOffset + rows + 1, height);
+	int firstRow = top - (rowOffset - 1);
+
+	tile.resize(size_t(stride) * (rows + 2));
+
+	float* data = tile.data() + size_t(firstRow) * stride;
+	if (terrainBand->rasterFloat(0, top, width, bottom - top, data, width, bottom - top)) {
+		throw std::runtime_error("FlowDirection: Failed to read terrain!");
+	}
+
+	// Spread the rows read contiguously into the padded layout, starting from the last one so nothing is overwritten
+	for (int row = bottom - top - 1; row >= 0; row--) {
+		memmove(data + size_t(row) * stride + 1, data + size_t(row) * width, width * sizeof(float));
+
+		data[size_t(row) * stride] = data[size_t(row) * stride + width + 1] = std::numeric_limits<float>::quiet_NaN();
+	}
+
+	// Halo rows outside of the raster
+	std::fill(tile.begin(), tile.begin() + size_t(firstRow) * stride, std::numeric_limits<float>::quiet_NaN());
+	std::fill(tile.begin() + size_t(firstRow + bottom - top) * stride, tile.end(), std::numeric_limits<float>::quiet_NaN());
+}
+
+int Plugin::calculateEnters(CANVAS_BYTE& directions, int x, int y, int index) {
+	int enters = 0;
 
 	for (int j = -1; j <= 1; j++) {
 		for (int i = -1; i <= 1; i++) {
@@ -33,28 +67,21 @@ int Plugin::calculateFlowDirection(CANVAS_FLOAT& terrain, int x, int y, int inde
 			int nx = x + i;
 			int ny = y + j;
 
-			auto toHolder = terrain->at(nx, ny, -index);
-			double to = toHolder.valid() ? toHolder : from - 0.0001; // Precision = 0.9999
-
-			double deltaZ = from - to;
-			if (deltaZ <= 0) {
+			auto neighbour = directions->at(nx, ny, ~index);
+			if (!neighbour.valid() || FlowCell::getDirection(neighbour) == directionNoData_.value()) {
 				continue;
 			}
 
-			double distance = (abs(i) + abs(j) == 2) ? 1.41 : 1.;
-			double slope = deltaZ / distance;
-
-			if (slope > maxSlope) {
-				maxSlope = slope;
-				direction = getDirection(i, j); // No zero!
+			if (getDirection(i, j) == 10 - FlowCell::getDirection(neighbour)) {
+				enters++;
 			}
 		}
 	}
 
-	return direction;
+	return enters;
 }
 
-int Plugin::calculateEnters(CANVAS_BYTE& directions, int x, int y, int index) {
+int Plugin::calculateEnters(const uint8_t* cell, int stride) {
 	int enters = 0;
 
 	for (int j = -1; j <= 1; j++) {
@@ -63,15 +90,12 @@ int Plugin::calculateEnters(CANVAS_BYTE& directions, int x, int y, int index) {
 				continue;
 			}
 
-			int nx = x + i;
-			int ny = y + j;
-
-			auto neighbour = directions->at(nx, ny, -index);
-			if (!neighbour.valid() || neighbour == directionNoData_.value()) {
+			int neighbour = FlowCell::getDirection(cell[j * stride + i]);
+			if (neighbour == directionNoData_.value()) {
 				continue;
 			}
 
-			if (getDirection(i, j) == 10 - abs(neighbour)) {
+			if (getDirection(i, j) == 10 - neighbour) {
 				enters++;
 			}
 		}
@@ -87,6 +111,9 @@ void Plugin::process(const std::string& name, const std::string& output, int thr
 
 	threadsCount = min(availableThreads, threadsCount);
 
+	report_ = RunReport();
+	Statistics::getInstance().reset();
+
 	std::cout << "Threads: " << threadsCount << "/" << availableThreads << " (" << (threadsCount * 100.f / availableThreads) << "%)" << std::endl;
 
 	std::cout << "Opening: " << name << std::endl;
@@ -100,46 +127,178 @@ void Plugin::process(const std::string& name, const std::string& output, int thr
 	int width = terrainBand->getXSize(), height = terrainBand->getYSize();
 	std::cout << "Raster size: " << width << "x" << height << std::endl;
 
+	report_.width = width;
+	report_.height = height;
+
 	terrainNoData_ = terrainBand->getNoDataValue();
 	std::cout << "Has nodata: " << (terrainNoData_ ? "yes (" + std::to_string(terrainNoData_.value()) + ")" : "no") << std::endl;
 
 	std::string projection = terrainReader->getProjection();
 	std::cout << "Projection: " << projection << std::endl;
 
-	CANVAS_FLOAT terrain(new Canvas<float>(terrainBand, true));
+	MEMORY_BUDGET budget(new MemoryBudget(memoryBudget_ ? memoryBudget_ : MemoryBudget::getAvailableMemory()));
+	std::cout << "Memory budget: " << budget->getLimit() / (1024 * 1024) << "MB" << std::endl;
 
-	bool interrupted = false;
+	std::cout << "Direction kernel: " << DirectionKernel::getInstructionSetName(DirectionKernel::detectInstructionSet()) << std::endl;
+
+	PREFETCHER prefetcher;
+
+	if (prefetchThreads_) {
+		prefetcher.reset(new Prefetcher(prefetchThreads_, prefetchDepth_));
+	}
 
-	size_t sourcesFileSize = 0;
+	std::cout << "Prefetch: " << (prefetcher ? std::to_string(prefetchThreads_) + " I/O threads, depth " + std::to_string(prefetcher->getDepth()) : "off") << std::endl;
+
+	// Directions and sources depend on the terrain and its conditioning only, a cache hit skips the whole direction stage
+	std::unique_ptr<ArtifactCache> cache;
+	std::string cacheKey;
+	bool cached = false;
+
+	// Incremental updates of filled directions need the filled terrain, it is saved next to them and never comes from the cache
+	std::string filledOutput;
+
+	if (conditioning_ == Conditioning::FillDepressions && !directionsOutput_.empty()) {
+		filledOutput = getFilledTerrainPath(directionsOutput_);
+	}
+
+	if (!cacheDirectory_.empty() && filledOutput.empty()) {
+		cache.reset(new ArtifactCache(cacheDirectory_, cacheLimit_));
+		cacheKey = ArtifactCache::makeKey(name, "conditioning=" + std::to_string(int(conditioning_)) + ";sources=" + std::to_string(accumulationMode_ != AccumulationMode::Tiled));
+		cached = cache->contains(cacheKey);
+		report_.cached = cached;
+
+		std::cout << "Artifact cache: " << (cached ? "hit" : "miss") << " (" << cacheKey << ")" << std::endl;
+	}
 
 	Timer timer;
 
-	{
-		std::fstream sourcesFile(temp.addFile("sources"), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
-		GEOTIFF_READER directionsReader(new GdalTiffReader(temp.addFile("directions").string(), width, height, 1));
-		directionsReader->setProjection(projection);
-		directionsReader->setGeoTransform(terrainReader->getGeoTransform());
+	// Depressions are filled into a Float32 copy of the terrain, the direction pass reads it instead
+	RASTER_BAND filledBand;
+	GEOTIFF_READER filledReader;
+	size_t filledRasterSize = 0;
+
+	if (conditioning_ == Conditioning::FillDepressions && !cached) {
+		size_t rasterSize = size_t(width) * height * sizeof(float);
+
+		if (rasterSize <= budget->getLimit() / 2 && budget->acquire(rasterSize)) {
+			filledBand.reset(new MemoryRasterBand<float>(width, height));
+			filledRasterSize = rasterSize;
+		}
+		else {
+			filledReader.reset(new GdalTiffReader(temp.addFile("filled").string(), width, height, 1, RasterDataType::Float32));
+			filledReader->setProjection(projection);
+			filledReader->setGeoTransform(terrainReader->getGeoTransform());
+			filledBand.reset(filledReader->getRasterBand(1));
+		}
+
+		if (terrainNoData_) {
+			filledBand->setNoDataValue(terrainNoData_.value());
+		}
+
+		std::cout << "Filled raster: " << (filledRasterSize ? "memory" : "disk") << " (" << rasterSize / (1024 * 1024) << "MB)" << std::endl;
+		std::cout << "---------------- DepressionFilling Started! ----------------" << std::endl;
+
+		Timer fillTimer;
+		StatisticsPhase phase("DepressionFilling");
+
+		std::shared_ptr<DepressionFiller> filler(new DepressionFiller(terrainBand, terrainNoData_, budget));
+		progressCallback_ = [filler]() -> int {
+			return filler->getProgress();
+		};
+
+		try {
+			filler->fill(filledBand, threadsCount);
+		}
+		catch (const std::runtime_error& exception) {
+			progressCallback_ = [] { return 0; };
+
+			std::cout << "<b>---------------- DepressionFilling Failed! ----------------</b>" << std::endl;
+			std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+			return;
+		}
+
+		phase.end();
+
+		std::cout << "---------------- DepressionFilling Finished! ----------------" << std::endl;
+		std::cout << "Spent time: " << fillTimer.elapsedSeconds() << "s" << std::endl;
+
+		report_.phases.push_back({ "DepressionFilling", fillTimer.elapsedSeconds(), size_t(width) * height });
+		report_.peakTempBytes = max(report_.peakTempBytes, temp.getSize());
+
+		std::cout << std::endl;
+	}
+
+	// Directions with in-degrees are shared by both phases, they stay in RAM if a half of the budget holds them
+	RASTER_BAND memoryDirectionsBand;
 
-		RASTER_BAND directionsBand(directionsReader->getRasterBand(1));
-		CANVAS_BYTE directions(new Canvas<int8_t>(directionsBand, true, true));
+	size_t tempRasterSize = size_t(width) * height;
+
+	if (tempRasterSize <= budget->getLimit() / 2 && budget->acquire(tempRasterSize)) {
+		memoryDirectionsBand.reset(new MemoryRasterBand<int8_t>(width, height));
+	}
+
+	std::cout << "Temp raster: " << (memoryDirectionsBand ? "memory" : "disk") << " (" << tempRasterSize / (1024 * 1024) << "MB)" << std::endl;
+
+	bool interrupted = false;
+
+	FlatResolver flats(width, height, threadsCount, budget);
+	SourcesList sources(temp, threadsCount, budget);
+
+	if (cached) {
+		if (memoryDirectionsBand) {
+			GEOTIFF_READER cachedReader(new GdalTiffReader(cache->getPath(cacheKey, "directions.tif").string()));
+			RASTER_BAND cachedBand(cachedReader->getRasterBand(1));
+
+			copyDirections(cachedBand, memoryDirectionsBand, false);
+			memoryDirectionsBand->setNoDataValue(directionNoData_.value());
+		}
+		else {
+			std::filesystem::copy_file(cache->getPath(cacheKey, "directions.tif"), temp.addFile("directions"));
+		}
+
+		sources.load(cache->getPath(cacheKey, "sources.bin"));
+
+		std::cout << "---------------- FlowDirections Cached! ----------------" << std::endl;
+	}
+	else {
+		GEOTIFF_READER directionsReader;
+		RASTER_BAND directionsBand = memoryDirectionsBand;
+
+		if (!directionsBand) {
+			directionsReader.reset(new GdalTiffReader(temp.addFile("directions").string(), width, height, 1));
+			directionsReader->setProjection(projection);
+			directionsReader->setGeoTransform(terrainReader->getGeoTransform());
+			directionsBand.reset(directionsReader->getRasterBand(1));
+		}
+
+		// Intermediate raster, nobody reads its statistics
+		CANVAS_BYTE directions(new Canvas<uint8_t>(directionsBand, true, budget, tileWidth_, tileHeight_, false));
+		directions->setPrefetcher(prefetcher);
 		directionsBand->setNoDataValue(directionNoData_.value());
 
+		// Slots are rounded up to the native blocks, the accumulation canvas of the directions gets the same ones
+		sources.setTileSize(directions->getSlotWidth(), directions->getSlotHeight());
+
+		RASTER_BAND sourceBand = filledBand ? filledBand : terrainBand;
+
 		std::vector<std::thread> threads;
 		threads.reserve(threadsCount);
 
 		std::cout << "---------------- FlowDirections Started! ----------------" << std::endl;
 
-		std::map<int, std::fstream> sourcesFiles;
-
 		Timer flowTimer;
+		StatisticsPhase phase("FlowDirections");
+
+		nextDirectionRow_ = 0;
+		nextSourceSlot_ = 0;
 
 		for (int i = 0; i < threadsCount; i++) {
-			threads.emplace_back([this, &temp, &terrain, &directions, width, height, i, &sourcesFiles, threadsCount, &interrupted]() {
-				try {
-					std::string fileName = temp.addFile("source_" + std::to_string(i)).string();
-					std::fstream& sources = sourcesFiles[i] = std::fstream(fileName, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+			threads.emplace_back([this, &sourceBand, &directionsBand, &directions, &prefetcher, width, height, i, &flats, &sources, threadsCount, &interrupted]() {
+				Timer threadTimer;
 
-					directionProcess(terrain, directions, width, height, i, sources, threadsCount);
+				try {
+					directionProcess(sourceBand, directionsBand, directions, prefetcher, width, height, i, flats, sources, threadsCount);
 				}
 				catch (const std::runtime_error& exception) {
 					progressCallback_ = [] { return 0; };
@@ -152,6 +311,8 @@ void Plugin::process(const std::string& name, const std::string& output, int thr
 				catch (...) {
 
 				}
+
+				Statistics::getInstance().addThreadTime(i, threadTimer.elapsedSeconds());
 				});
 		}
 
@@ -165,85 +326,225 @@ void Plugin::process(const std::string& name, const std::string& output, int thr
 			return;
 		}
 
-		for (auto& [key, source] : sourcesFiles) {
-			source.seekg(0, std::ios::end);
-			size_t sourceFileSize = source.tellg();
-			source.seekg(0, std::ios::beg);
-			std::vector<char> buffer(sourceFileSize);
-			source.read(buffer.data(), sourceFileSize);
+		sources.finish();
+
+		// The changed slots are written inside the phase, so its time and statistics cover them
+		directions->flush();
+
+		if (!filledOutput.empty()) {
+			GEOTIFF_READER outputReader(new GdalTiffReader(filledOutput, width, height, 1, RasterDataType::Float32));
+			outputReader->setProjection(projection);
+			outputReader->setGeoTransform(terrainReader->getGeoTransform());
+			outputReader->setMetadataItem(CONDITIONING_ITEM, getConditioningName(conditioning_));
 
-			sourcesFile.write(buffer.data(), sourceFileSize);
-			sourcesFileSize += sourceFileSize;
+			RASTER_BAND outputBand(outputReader->getRasterBand(1));
 
-			source.close();
+			if (terrainNoData_) {
+				outputBand->setNoDataValue(terrainNoData_.value());
+			}
+
+			copyTerrain(filledBand, outputBand);
 
-			temp.deleteFile("source_" + std::to_string(key));
+			std::cout << "Filled terrain saved: " << filledOutput << std::endl;
 		}
 
+		// The filled terrain isn't needed past the direction pass
+		filledBand.reset();
+		filledReader.reset();
+		budget->release(filledRasterSize);
+
+		std::cout << "Flat cells: " << flats.size() << " in " << flats.getFlatsCount() << " flats" << std::endl;
+		printStatistics("Directions", directions->getStatistics());
+
+		phase.end();
+
 		std::cout << "---------------- FlowDirections Finished! ----------------" << std::endl;
 		std::cout << "Spent time: " << flowTimer.elapsedSeconds() << "s" << std::endl;
+
+		report_.phases.push_back({ "FlowDirections", flowTimer.elapsedSeconds(), size_t(width) * height });
+		report_.peakTempBytes = max(report_.peakTempBytes, temp.getSize());
+	}
+
+	// The accumulation counts the in-degrees off, so the entry is stored before it starts. A failure costs the next run only.
+	if (cache && !cached) {
+		try {
+			std::filesystem::path staging = cache->begin(cacheKey);
+
+			{
+				GEOTIFF_READER directionsReader;
+				RASTER_BAND directionsBand = memoryDirectionsBand;
+
+				if (!directionsBand) {
+					directionsReader.reset(new GdalTiffReader(temp.getPath("directions").string()));
+					directionsBand.reset(directionsReader->getRasterBand(1));
+				}
+
+				GEOTIFF_READER cachedReader(new GdalTiffReader((staging / "directions.tif").string(), width, height, 1));
+				RASTER_BAND cachedBand(cachedReader->getRasterBand(1));
+				cachedBand->setNoDataValue(directionNoData_.value());
+
+				copyDirections(directionsBand, cachedBand, false);
+			}
+
+			sources.save(staging / "sources.bin");
+			cache->commit(cacheKey);
+		}
+		catch (const std::exception& exception) {
+			std::cout << "Artifact cache: failed to store (" << exception.what() << ")" << std::endl;
+		}
 	}
 
 	std::cout << std::endl;
 
-	{
-		std::filesystem::path result_file = output;
-		GEOTIFF_READER accumulationReader(new GdalTiffReader(result_file.string(), width, height, 1, true));
-		accumulationReader->setProjection(projection);
-		accumulationReader->setGeoTransform(terrainReader->getGeoTransform());
+	// Two passes over the tiles instead of walking the paths, no canvases nor sources needed
+	if (accumulationMode_ == AccumulationMode::Tiled) {
+		// Square tiles cross the blocks of a strip layout, a compressed output is written once from an uncompressed raster
+		bool compressed = !creationProfile_.compression.empty();
+		GEOTIFF_READER accumulationReader;
+
+		if (compressed) {
+			accumulationReader.reset(new GdalTiffReader(temp.addFile("accumulation").string(), width, height, 1, RasterDataType::UInt32, { creationProfile_.blockSize }));
+		}
+		else {
+			accumulationReader.reset(new GdalTiffReader(std::filesystem::path(output).string(), width, height, 1, RasterDataType::UInt32, creationProfile_));
+			accumulationReader->setProjection(projection);
+			accumulationReader->setGeoTransform(terrainReader->getGeoTransform());
+		}
 
 		RASTER_BAND accumaltionBand(accumulationReader->getRasterBand(1));
 
-		GEOTIFF_READER directionsReader(new GdalTiffReader(temp.getPath("directions").string()));
-		RASTER_BAND directionsBand(directionsReader->getRasterBand(1));
+		GEOTIFF_READER directionsReader;
+		RASTER_BAND directionsBand = memoryDirectionsBand;
+
+		if (!directionsBand) {
+			directionsReader.reset(new GdalTiffReader(temp.getPath("directions").string()));
+			directionsBand.reset(directionsReader->getRasterBand(1));
+		}
+
+		std::cout << "Output layout: " << (creationProfile_.blockSize ? "tiled " + std::to_string(creationProfile_.blockSize) : "strips") << ", " << (creationProfile_.compression.empty() ? "uncompressed" : creationProfile_.compression) << std::endl;
+		std::cout << "Accumulation mode: tiled" << std::endl;
+		std::cout << "---------------- FlowAccumulation Started! ----------------" << std::endl;
+
+		Timer flowTimer;
+		StatisticsPhase phase("FlowAccumulation");
+
+		try {
+			std::shared_ptr<TiledAccumulator> accumulator(new TiledAccumulator(directionsBand, accumaltionBand, directionNoData_.value(), tileWidth_, tileHeight_, budget));
+
+			progressCallback_ = [accumulator]() -> int {
+				return accumulator->getProgress();
+			};
 
-		CANVAS_UINT32 accumaltion(new Canvas<uint32_t>(accumaltionBand, false, true));
-		CANVAS_BYTE directions(new Canvas<int8_t>(directionsBand, true));
+			accumulator->accumulate(threadsCount);
 
-		std::queue<CHUNK_BORDERS> chunks;
-		Spinlock chunkMutex;
+			// The tiles are written by the accumulator, not through a canvas keeping the statistics
+			if (!compressed) {
+				accumaltionBand->computeRasterMinMax();
+			}
+		}
+		catch (const std::runtime_error& exception) {
+			progressCallback_ = [] { return 0; };
+
+			std::cout << "<b>---------------- FlowAccumulation Failed! ----------------</b>" << std::endl;
+			std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+			return;
+		}
+
+		if (compressed) {
+			Timer copyTimer;
+
+			GEOTIFF_READER outputReader(new GdalTiffReader(std::filesystem::path(output).string(), width, height, 1, RasterDataType::UInt32, creationProfile_));
+			outputReader->setProjection(projection);
+			outputReader->setGeoTransform(terrainReader->getGeoTransform());
+
+			RASTER_BAND outputBand(outputReader->getRasterBand(1));
+
+			copyAccumulation(accumaltionBand, outputBand);
+			outputBand->computeRasterMinMax();
+
+			std::cout << "Output compressed in: " << copyTimer.elapsedSeconds() << "s" << std::endl;
+		}
+
+		phase.end();
+
+		std::cout << "---------------- FlowAccumulation Finished! ----------------" << std::endl;
+		std::cout << "Spent time: " << flowTimer.elapsedSeconds() << "s" << std::endl;
+
+		report_.phases.push_back({ "FlowAccumulation", flowTimer.elapsedSeconds(), size_t(width) * height });
+		report_.peakTempBytes = max(report_.peakTempBytes, temp.getSize());
+	}
+	else {
+		std::filesystem::path result_file = output;
+
+		// Evicted tiles are written again on every eviction, GTiff appends each rewrite of a compressed block.
+		// The walks fill an uncompressed raster of the same layout then and the output is written from it once.
+		bool compressed = !creationProfile_.compression.empty();
+		GEOTIFF_READER accumulationReader;
+
+		if (compressed) {
+			accumulationReader.reset(new GdalTiffReader(temp.addFile("accumulation").string(), width, height, 1, RasterDataType::UInt32, { creationProfile_.blockSize }));
+		}
+		else {
+			accumulationReader.reset(new GdalTiffReader(result_file.string(), width, height, 1, RasterDataType::UInt32, creationProfile_));
+			accumulationReader->setProjection(projection);
+			accumulationReader->setGeoTransform(terrainReader->getGeoTransform());
+		}
 
-		size_t totalSourceCount = sourcesFileSize / sizeof(Source);
+		RASTER_BAND accumaltionBand(accumulationReader->getRasterBand(1));
 
-		size_t numOfSourcesToRead = 100000;
-		size_t sourcesSizeToRead = numOfSourcesToRead * sizeof(Source);
-		for (size_t begin = 0; begin < sourcesFileSize; begin += sourcesSizeToRead) {
-			size_t chunkSize = min(sourcesSizeToRead, sourcesFileSize - begin);
-			CHUNK_BORDERS chunk = { begin, chunkSize };
+		GEOTIFF_READER directionsReader;
+		RASTER_BAND directionsBand = memoryDirectionsBand;
 
-			chunks.push(chunk);
+		if (!directionsBand) {
+			directionsReader.reset(new GdalTiffReader(temp.getPath("directions").string(), true));
+			directionsBand.reset(directionsReader->getRasterBand(1));
 		}
 
+		// Only the output gets statistics, a compressed one when it is copied
+		CANVAS_UINT32 accumaltion(new Canvas<uint32_t>(accumaltionBand, true, budget, tileWidth_, tileHeight_, !compressed));
+		CANVAS_BYTE directions(new Canvas<uint8_t>(directionsBand, true, budget, tileWidth_, tileHeight_, false));
+
+		accumaltion->setPrefetcher(prefetcher);
+		directions->setPrefetcher(prefetcher);
+
+		size_t totalSourceCount = sources.size();
+		auto chunks = sources.split(100000);
+
+		// Grains are small enough for a single costly chunk to be shared by the threads
+		ChunkScheduler scheduler(chunks, threadsCount, 4096, accumaltion->getSlotWidth(), accumaltion->getSlotHeight());
+
 		std::cout << "Total source count: " << totalSourceCount << std::endl;
+		std::cout << "Sources order: tiles " << directions->getSlotWidth() << "x" << directions->getSlotHeight() << ", Z-order inside" << std::endl;
 		std::cout << "Chunk count: " << chunks.size() << std::endl;
 
 		std::vector<std::thread> threads;
 		threads.reserve(threadsCount);
 
+		std::cout << "Output layout: " << (creationProfile_.blockSize ? "tiled " + std::to_string(creationProfile_.blockSize) : "strips") << ", " << (creationProfile_.compression.empty() ? "uncompressed" : creationProfile_.compression) << std::endl;
+		std::cout << "Accumulation tiles: " << accumaltion->getSlotWidth() << "x" << accumaltion->getSlotHeight() << std::endl;
+		std::cout << "Accumulation mode: paths" << std::endl;
 		std::cout << "---------------- FlowAccumulation Started! ----------------" << std::endl;
 
 		Timer flowTimer;
+		StatisticsPhase phase("FlowAccumulation");
 
-		for (int i = 0; i < threadsCount; i++) {
-			threads.emplace_back([this, &accumaltion, &directions, i, &chunks, &chunkMutex, threadsCount, &interrupted, &temp, totalSourceCount]() {
-				try {
-					std::fstream sourcesFile(temp.getPath("sources"), std::ios::in | std::ios::out | std::ios::binary);
+		accumulatedSources_ = 0;
+		progressCallback_ = [this, totalSourceCount]() -> int {
+				return int(accumulatedSources_.load() / float(totalSourceCount) * 100);
+			};
 
-					while (true) {
-						CHUNK_BORDERS chunk;
-
-						{
-							std::unique_lock lock(chunkMutex);
+		for (int i = 0; i < threadsCount; i++) {
+			threads.emplace_back([this, &accumaltion, &directions, i, &scheduler, threadsCount, &interrupted]() {
+				Timer threadTimer;
 
-							if (chunks.empty()) {
-								break;
-							}
+				std::cout << "Thread ID: " << i << " (0x" << std::setfill('0') << std::setw(8) << std::right << std::this_thread::get_id() << ")" << std::endl;
 
-							chunk = chunks.front();
-							chunks.pop();
-						}
+				try {
+					SourcesChunk chunk;
 
-						accumulationProcess(accumaltion, directions, i, sourcesFile, chunk, threadsCount, totalSourceCount);
+					while (scheduler.pop(i, chunk)) {
+						accumulationProcess(accumaltion, directions, i, chunk, threadsCount);
 					}
 				}
 				catch (const std::runtime_error& exception) {
@@ -257,6 +558,8 @@ void Plugin::process(const std::string& name, const std::string& output, int thr
 				catch (...) {
 
 				}
+
+				Statistics::getInstance().addThreadTime(i, threadTimer.elapsedSeconds());
 				});
 		}
 
@@ -270,61 +573,254 @@ void Plugin::process(const std::string& name, const std::string& output, int thr
 			return;
 		}
 
+		accumaltion->flush();
+		directions->flush();
+
+		printStatistics("Accumulation", accumaltion->getStatistics());
+		printStatistics("Directions", directions->getStatistics());
+
+		for (int i = 0; i < threadsCount; i++) {
+			std::cout << "Thread ID: " << i << " Stolen chunks: " << scheduler.getStolenCount(i) << std::endl;
+		}
+
+		// Comparable between runs over terrains of any size, the sources order cuts it down
+		CanvasStatistics accumulationStatistics = accumaltion->getStatistics(), directionsStatistics = directions->getStatistics();
+		size_t prefetches = accumulationStatistics.prefetches + directionsStatistics.prefetches;
+		size_t slotLoads = accumulationStatistics.misses + directionsStatistics.misses + prefetches;
+
+		std::cout << "Slot loads: " << slotLoads << " (" << (totalSourceCount ? slotLoads * 1e6 / totalSourceCount : 0) << " per million sources, " << prefetches << " prefetched)" << std::endl;
+
+		if (compressed) {
+			Timer copyTimer;
+
+			accumaltion.reset();
+
+			GEOTIFF_READER outputReader(new GdalTiffReader(result_file.string(), width, height, 1, RasterDataType::UInt32, creationProfile_));
+			outputReader->setProjection(projection);
+			outputReader->setGeoTransform(terrainReader->getGeoTransform());
+
+			RASTER_BAND outputBand(outputReader->getRasterBand(1));
+
+			copyAccumulation(accumaltionBand, outputBand);
+			outputBand->computeRasterMinMax();
+
+			std::cout << "Output compressed in: " << copyTimer.elapsedSeconds() << "s" << std::endl;
+		}
+
+		phase.end();
+
 		std::cout << "---------------- FlowAccumulation Finished! ----------------" << std::endl;
 		std::cout << "Spent time: " << flowTimer.elapsedSeconds() << "s" << std::endl;
+
+		report_.phases.push_back({ "FlowAccumulation", flowTimer.elapsedSeconds(), size_t(width) * height });
+		report_.peakTempBytes = max(report_.peakTempBytes, temp.getSize());
 	}
 
+	// D8 codes without the in-degrees are kept for incremental updates after edits of the terrain
+	if (!directionsOutput_.empty()) {
+		GEOTIFF_READER directionsReader;
+		RASTER_BAND directionsBand = memoryDirectionsBand;
+
+		if (!directionsBand) {
+			directionsReader.reset(new GdalTiffReader(temp.getPath("directions").string()));
+			directionsBand.reset(directionsReader->getRasterBand(1));
+		}
+
+		GEOTIFF_READER outputReader(new GdalTiffReader(directionsOutput_, width, height, 1, RasterDataType::Int8, creationProfile_));
+		outputReader->setProjection(projection);
+		outputReader->setGeoTransform(terrainReader->getGeoTransform());
+		outputReader->setMetadataItem(CONDITIONING_ITEM, getConditioningName(conditioning_));
+
+		RASTER_BAND outputBand(outputReader->getRasterBand(1));
+		outputBand->setNoDataValue(directionNoData_.value());
+
+		copyDirections(directionsBand, outputBand, true);
+
+		std::cout << "Directions saved: " << directionsOutput_ << std::endl;
+	}
+
+	report_.peakWorkingSet = MemoryBudget::getPeakWorkingSet();
+	report_.succeeded = true;
+
 	std::cout << "---------------- Finished ----------------" << std::endl;
 	std::cout << "Spent time: " << timer.elapsedSeconds() << "s" << std::endl;
 	std::cout << std::endl;
 }
 
-void Plugin::directionProcess(CANVAS_FLOAT& terrain, CANVAS_BYTE& directions, int width, int height, int index, std::fstream& sourcesFile, int threadsCount) {
+void Plugin::update(const std::string& name, const std::string& directions, const std::string& accumulation, int x, int y, int width, int height) {
+	std::cout << "Opening: " << name << std::endl;
+
+	GEOTIFF_READER terrainReader(new GdalTiffReader(name));
+	GEOTIFF_READER directionsReader(new GdalTiffReader(directions, true));
+	GEOTIFF_READER accumulationReader(new GdalTiffReader(accumulation, true));
+
+	RASTER_BAND terrainBand(terrainReader->getRasterBand(1));
+	RASTER_BAND directionsBand(directionsReader->getRasterBand(1));
+	RASTER_BAND accumulationBand(accumulationReader->getRasterBand(1));
+
+	// Directions without the item were saved unconditioned
+	std::string conditioning = directionsReader->getMetadataItem(CONDITIONING_ITEM);
+	std::string terrainConditioning = terrainReader->getMetadataItem(CONDITIONING_ITEM);
+
+	if (conditioning.empty()) {
+		conditioning = getConditioningName(Conditioning::None);
+	}
+
+	if (terrainConditioning.empty()) {
+		terrainConditioning = getConditioningName(Conditioning::None);
+	}
+
+	if (conditioning != terrainConditioning) {
+		throw std::runtime_error("Incremental: Directions were computed from " + conditioning + " terrain, but " + name + " is " + terrainConditioning + (conditioning == getConditioningName(Conditioning::None) ? "!" : ", edit " + getFilledTerrainPath(directions) + " instead!"));
+	}
+
+	MEMORY_BUDGET budget(new MemoryBudget(memoryBudget_ ? memoryBudget_ : MemoryBudget::getAvailableMemory()));
+
+	std::cout << "Edited window: " << x << "," << y << " " << width << "x" << height << std::endl;
+	std::cout << "---------------- IncrementalUpdate Started! ----------------" << std::endl;
+
+	Timer timer;
+
+	{
+		IncrementalUpdater updater(terrainBand, directionsBand, accumulationBand, budget);
+		updater.update(x, y, width, height);
+
+		std::cout << "Changed directions: " << updater.getChangedCount() << std::endl;
+		std::cout << "Updated cells: " << updater.getVisitedCount() << std::endl;
+	}
+
+	std::cout << "---------------- IncrementalUpdate Finished! ----------------" << std::endl;
+	std::cout << "Spent time: " << timer.elapsedSeconds() << "s" << std::endl;
+	std::cout << std::endl;
+}
+
+// Rows of the terrain read ahead of the direction pass, see readTerrainTile
+struct TerrainBand {
+	int offset = 0;
+	int rows = 0;
+	std::vector<float> tile;
+	std::future<void> ready;
+
+	// The read may still be running on an I/O thread when the worker unwinds
+	~TerrainBand() {
+		if (ready.valid()) {
+			ready.wait();
+		}
+	}
+};
+
+void Plugin::directionProcess(RASTER_BAND& terrainBand, RASTER_BAND& directionsBand, CANVAS_BYTE& directions, PREFETCHER& prefetcher, int width, int height, int index, FlatResolver& flats, SourcesList& sources, int threadsCount) {
 	static Barrier syncPoint;
+	static Barrier flatsLabelled;
+	static Barrier flatsResolved;
 	static std::atomic_bool interrupted;
-	static std::atomic_int counter;
-
-	int heightPerThread = height / threadsCount;
-	int residualHeight = height - (heightPerThread * threadsCount);
-	int rowOffset = heightPerThread * index;
-	Source source;
+	static std::atomic_int64_t counter;
 
 	interrupted = false;
 	counter = 0;
 
-	int tileHeight = terrain->getHeight();
-	progressCallback_ = [tileHeight]() -> int {
-			return int(counter.load() / float(tileHeight * 2) * 100);
+	progressCallback_ = [width, height]() -> int {
+			return int(counter.load() / (float(width) * height * 2) * 100);
 		};
 
-	height = heightPerThread;
-	if (index == threadsCount - 1) {
-		height += residualHeight;
+	std::cout << "Thread Created ID: " << index << " (0x" << std::setfill('0') << std::setw(8) << std::right << std::this_thread::get_id() << ")" << std::endl;
+
+	int tileRows = max(1, (16 * 1024 * 1024) / int(width * sizeof(float))); // 16MB
+	int stride = width + 2;
+
+	// Small bands taken from a shared counter, threads over nodata take more of them instead of idling at the barrier
+	int bandRows = min(tileRows, max(16, height / (threadsCount * 8)));
+
+	int8_t codes[8];
+	for (int j = -1, k = 0; j <= 1; j++) {
+		for (int i = -1; i <= 1; i++) {
+			if (i != 0 || j != 0) {
+				codes[k++] = getDirection(i, j); // No zero!
+			}
+		}
 	}
 
-	std::cout << "Thread Created ID: " << index << " (0x" << std::setfill('0') << std::setw(8) << std::right << std::this_thread::get_id() << ")\t Row Offset: " << rowOffset << "\t Height: " << height << std::endl;
+	DirectionKernel kernel(stride, codes, terrainNoData_, directionNoData_.value());
 
-	for (int y = rowOffset; y < rowOffset + height; y++) {
-		for (int x = 0; x < width; x++) {
-			if (interrupted.load(std::memory_order_relaxed)) {
-				throw std::exception();
+	std::vector<int8_t> directionsTile;
+
+	// Bands are claimed ahead and read on the I/O threads while the current one is computed
+	int depth = prefetcher ? prefetcher->getDepth() : 0;
+	std::deque<std::unique_ptr<TerrainBand>> bands;
+
+	// A failed read, push or write still reaches the barrier, the other threads would wait for it forever
+	try {
+		while (true) {
+			while (int(bands.size()) <= depth) {
+				int offset = nextDirectionRow_.fetch_add(bandRows);
+
+				if (offset >= height) {
+					break;
+				}
+
+				bands.push_back(std::make_unique<TerrainBand>());
+
+				TerrainBand* band = bands.back().get();
+				band->offset = offset;
+				band->rows = min(bandRows, height - offset);
+
+				auto read = std::make_shared<std::packaged_task<void()>>([this, &terrainBand, width, height, band]() {
+					readTerrainTile(terrainBand, width, height, band->offset, band->rows, band->tile);
+					});
+
+				band->ready = read->get_future();
+
+				if (!prefetcher || !prefetcher->submit([read]() { (*read)(); })) {
+					(*read)();
+				}
 			}
 
-			int direction = directionNoData_.value();
-			if (!terrainNoData_.has_value() || terrain->at(x, y, index) != terrainNoData_.value()) {
-				direction = calculateFlowDirection(terrain, x, y, index);
+			if (bands.empty()) {
+				break;
 			}
 
-			if (!direction) {
-				interrupted = true;
+			std::unique_ptr<TerrainBand> band = std::move(bands.front());
+			bands.pop_front();
+
+			band->ready.get();
+
+			int tileOffset = band->offset;
+			int rows = band->rows;
+			const std::vector<float>& terrainTile = band->tile;
+
+			directionsTile.resize(size_t(width) * rows);
+
+			for (int y = 0; y < rows; y++) {
+				if (interrupted.load(std::memory_order_relaxed)) {
+					throw std::exception();
+				}
+
+				const float* terrainRow = terrainTile.data() + size_t(y + 1) * stride + 1;
+				int8_t* directionsRow = directionsTile.data() + size_t(y) * width;
 
-				throw std::runtime_error("FlowDirection: Invalid direction!");
+				// Cells without a downslope neighbour are left for the flat resolution
+				if (!kernel.computeRow(terrainRow, width, directionsRow, DirectionKernel::getEdges(0, tileOffset + y, width, width, height))) {
+					for (int x = 0; x < width; x++) {
+						if (!directionsRow[x]) {
+							flats.push(index, x, tileOffset + y, FlatResolver::getEqualNeighbours(terrainRow + x, stride));
+						}
+					}
+				}
 			}
 
-			directions->at(x, y, index) = direction;
+			if (directionsBand->raster(0, tileOffset, width, rows, directionsTile.data(), width, rows)) {
+				throw std::runtime_error("FlowDirection: Failed to write directions!");
+			}
+
+			counter.fetch_add(int64_t(width) * rows, std::memory_order_relaxed);
+			Statistics::getInstance().addThreadCells(index, size_t(width) * rows);
 		}
-	
-		counter.fetch_add(1, std::memory_order_relaxed);
+	}
+	catch (...) {
+		interrupted = true;
+		syncPoint.wait(threadsCount, [] { return interrupted.load(std::memory_order_relaxed); });
+
+		throw;
 	}
 
 	syncPoint.wait(threadsCount, [] { return interrupted.load(std::memory_order_relaxed); });
@@ -333,116 +829,137 @@ void Plugin::directionProcess(CANVAS_FLOAT& terrain, CANVAS_BYTE& directions, in
 		throw std::exception();
 	}
 
+	// Flats are labelled by one thread and resolved by all of them, every thread passes both barriers before rethrowing
+	std::exception_ptr failure;
+
+	if (index == 0) {
+		try {
+			flats.prepare();
+		}
+		catch (...) {
+			failure = std::current_exception();
+			interrupted = true;
+		}
+	}
+
+	flatsLabelled.wait(threadsCount);
+
+	if (!interrupted.load(std::memory_order_relaxed)) {
+		try {
+			flats.resolve(directions, codes, index);
+		}
+		catch (...) {
+			failure = std::current_exception();
+			interrupted = true;
+		}
+	}
+
+	flatsResolved.wait(threadsCount);
+
+	if (failure) {
+		std::rethrow_exception(failure);
+	}
+
+	if (interrupted.load(std::memory_order_relaxed)) {
+		throw std::exception();
+	}
+
 	std::cout << "Thread ID: " << index << " Looking for sources..." << std::endl;
 
-	for (int y = rowOffset; y < rowOffset + height; y++) {
-		for (int x = 0; x < width; x++) {
-			auto direction = directions->at(x, y, index);
+	int slotWidth = directions->getSlotWidth();
+	int slotHeight = directions->getSlotHeight();
 
-			if (direction == directionNoData_.value()) {
-				continue;
-			}
+	int slotsPerRow = (width + slotWidth - 1) / slotWidth;
+	int slotsCount = slotsPerRow * ((height + slotHeight - 1) / slotHeight);
 
-			int enters = calculateEnters(directions, x, y, index);
+	// Whole slots taken from a shared counter through pinned views, only the slot borders need the neighbours of other slots.
+	// The next slot is claimed before the current one is scanned, so it is loaded meanwhile.
+	for (int slot = nextSourceSlot_++, next; slot < slotsCount; slot = next) {
+		if (interrupted.load(std::memory_order_relaxed)) {
+			throw std::exception();
+		}
 
-			if (!enters) {
-				source = { x, y };
+		next = nextSourceSlot_++;
 
-				sourcesFile.write((char*)&source, sizeof(Source));
-			}
-			else if (enters > 1) {
-				direction = -direction;
-			}
+		if (next < slotsCount) {
+			directions->prefetch(next % slotsPerRow * slotWidth, next / slotsPerRow * slotHeight);
 		}
 
-		counter.fetch_add(1, std::memory_order_relaxed);
-	}
-}
+		int left = slot % slotsPerRow * slotWidth;
+		int top = slot / slotsPerRow * slotHeight;
 
-void Plugin::accumulationProcess(CANVAS_UINT32& accumulation, CANVAS_BYTE& directions, int index, std::fstream& sourcesFile, CHUNK_BORDERS& chunk, int threadsCount, size_t totalSourceCount) {
-	static Spinlock readMutex, writeMutex;
-	static std::atomic_int64_t counter;
+		auto directionsView = directions->view(left, top, true);
 
-	size_t sourceCount = chunk.second / sizeof(Source);
+		int slotRight = left + directionsView.getWidth();
+		int slotBottom = top + directionsView.getHeight();
 
-	std::vector<Source> sources(sourceCount);
+		for (int y = top; y < slotBottom; y++) {
+			uint8_t* directionsRow = directionsView.row(y);
 
-	sourcesFile.seekg(chunk.first);
-	sourcesFile.read((char*)sources.data(), chunk.second);
-	
-	if (!chunk.first) {
-		counter = 0;
-	}
+			bool inner = y > top && y < slotBottom - 1;
 
-	progressCallback_ = [totalSourceCount]() -> int {
-			return int(counter.load() / float(totalSourceCount) * 100);
-		};
+			for (int x = left; x < slotRight; x++) {
+				uint8_t& cell = directionsRow[x - left];
 
-	std::cout << "Thread ID: " << index << " (0x" << std::setfill('0') << std::setw(8) << std::right << std::this_thread::get_id() << ")\t Start Point: " << chunk.first << "\t End Point: " << chunk.first + chunk.second << "\t Sources Count: " << sourceCount << std::endl;
+				int direction = FlowCell::getDirection(cell);
+				if (direction == directionNoData_.value()) {
+					continue;
+				}
 
-	for (const auto& source : sources) {
-		int x = source.x;
-		int y = source.y;
+				int enters = inner && x > left && x < slotRight - 1 ? calculateEnters(&cell, directionsView.getWidth()) : calculateEnters(directions, x, y, index);
 
-		int32_t value = 1;
+				cell = FlowCell::make(direction, enters);
 
-		while (true) {
-			auto direction = directions->at(x, y, index);
-			if (!direction.valid() || direction == directionNoData_.value()) {
-				break;
+				if (!enters && accumulationMode_ != AccumulationMode::Tiled) {
+					sources.push(index, { x, y });
+				}
 			}
+		}
 
-			auto data = accumulation->at(x, y, index);
-			if (data) {
-				break;
-			}
+		counter.fetch_add(int64_t(slotRight - left) * (slotBottom - top), std::memory_order_relaxed);
+	}
 
-			std::unique_lock<Spinlock> lock;
-			if (direction < 0) {
-				lock = std::unique_lock(writeMutex);
-				uint32_t tempValue = 0;
-				bool isOwner = true;
+	sources.completePart(index);
+}
 
-				for (int j = -1; j <= 1; j++) {
-					for (int i = -1; i <= 1; i++) {
-						if (!isOwner) {
-							break;
-						}
+void Plugin::accumulationProcess(CANVAS_UINT32& accumulation, CANVAS_BYTE& directions, int index, const SourcesChunk& chunk, int threadsCount) {
+	size_t cells = 0;
 
-						if (i == 0 && j == 0) {
-							continue;
-						}
+	for (const Source* source = chunk.data; source != chunk.data + chunk.count; source++) {
+		int x = source->x;
+		int y = source->y;
 
-						int nx = x + i;
-						int ny = y + j;
+		uint32_t value = 1;
 
-						auto neighbourDirection = directions->at(nx, ny, -index);
-						if (!neighbourDirection.valid()) {
-							continue;
-						}
+		while (true) {
+			auto cell = directions->at(x, y, index);
+			if (!cell.valid()) {
+				break;
+			}
 
-						if (getDirection(i, j) != 10 - abs(neighbourDirection)) {
-							continue;
-						}
+			// The in-degree is counted off by other walkers, so the cell is read atomically
+			uint8_t flow = cell.load();
 
-						auto neighbour = accumulation->at(nx, ny, -index);
+			int direction = FlowCell::getDirection(flow);
+			if (direction == directionNoData_.value()) {
+				break;
+			}
 
-						if (neighbour == 0) {
-							isOwner = false;
+			auto data = accumulation->at(x, y, index);
 
-							break;
-						}
-						else {
-							tempValue += neighbour;
-						}
-					}
-				}
+			// Every walker reaching a confluence leaves its upstream sum there and counts itself off,
+			// only the last one to arrive reads the complete sum back and continues downstream.
+			if (FlowCell::getInDegree(flow) > 1) {
+				data.fetchAdd(value - 1);
 
-				if (!isOwner) {
+				if (FlowCell::getInDegree(cell.fetchAdd(uint8_t(-FlowCell::IN_DEGREE_ONE))) > 1) {
 					break;
 				}
 
-				value = ++tempValue;
+				value = data.fetchAdd(0) + 1;
+			}
+			else {
+				value += data; // Zero unless the others have already counted off and left their sums here
 			}
 
 			data = value++;
@@ -452,16 +969,199 @@ void Plugin::accumulationProcess(CANVAS_UINT32& accumulation, CANVAS_BYTE& direc
 
 			x += i;
 			y += j;
+
+			cells++;
+		}
+
+		accumulatedSources_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Statistics::getInstance().addThreadCells(index, cells);
+}
+
+void Plugin::createJob(const std::string& name, const std::string& output, const std::string& directory) {
+	TileJob::create(directory, name, output, tileWidth_, tileHeight_);
+
+	std::cout << "Job created: " << directory << std::endl;
+}
+
+void Plugin::runJobWorker(const std::string& directory, int stage, int worker, int workersCount, int threadsCount) {
+	MEMORY_BUDGET budget(new MemoryBudget(memoryBudget_ ? memoryBudget_ : MemoryBudget::getAvailableMemory()));
+
+	if (stage < int(TileJob::Stage::Directions) || stage > int(TileJob::Stage::Accumulation) || worker < 0 || worker >= workersCount) {
+		throw std::runtime_error("TileJob: Invalid worker!");
+	}
+
+	Timer timer;
+
+	TileJob job(directory, budget);
+	job.work(TileJob::Stage(stage), worker, workersCount, max(threadsCount, 1));
+
+	std::cout << "Stage " << stage << " worker " << worker << " spent time: " << timer.elapsedSeconds() << "s" << std::endl;
+}
+
+void Plugin::mergeJob(const std::string& directory, int stage, int threadsCount) {
+	MEMORY_BUDGET budget(new MemoryBudget(memoryBudget_ ? memoryBudget_ : MemoryBudget::getAvailableMemory()));
+
+	if (stage < int(TileJob::Stage::Directions) || stage > int(TileJob::Stage::Accumulation)) {
+		throw std::runtime_error("TileJob: Invalid stage!");
+	}
+
+	Timer timer;
+
+	TileJob job(directory, budget);
+	job.merge(TileJob::Stage(stage), creationProfile_, max(threadsCount, 1));
+
+	std::cout << "Stage " << stage << " merge spent time: " << timer.elapsedSeconds() << "s" << std::endl;
+}
+
+void Plugin::runJob(const std::string& name, const std::string& output, const std::string& directory, int workersCount, int threadsCount) {
+	if (workersCount <= 0) {
+		throw std::runtime_error("TileJob: Invalid workers count!");
+	}
+
+	Timer timer;
+
+	createJob(name, output, directory);
+
+	// The workers run at once, they share the budget of the job
+	size_t workerBudget = (memoryBudget_ ? memoryBudget_ : MemoryBudget::getAvailableMemory()) / workersCount;
+
+	for (int stage = int(TileJob::Stage::Directions); stage <= int(TileJob::Stage::Accumulation); stage++) {
+		TileJob::runWorkers(directory, TileJob::Stage(stage), workersCount, max(threadsCount, 1), workerBudget);
+
+		// The workers are done, the merge has the threads of all of them
+		mergeJob(directory, stage, workersCount * max(threadsCount, 1));
+	}
+
+	std::cout << "Job of " << workersCount << " workers spent time: " << timer.elapsedSeconds() << "s" << std::endl;
+}
+
+void Plugin::copyDirections(RASTER_BAND& source, RASTER_BAND& target, bool codesOnly) {
+	int width = source->getXSize(), height = source->getYSize();
+
+	std::vector<uint8_t> row(width);
+
+	for (int y = 0; y < height; y++) {
+		if (source->rasterByte(0, y, width, 1, row.data(), width, 1)) {
+			throw std::runtime_error("FlowDirection: Failed to read directions!");
+		}
+
+		if (codesOnly) {
+			for (auto& cell : row) {
+				cell = uint8_t(FlowCell::getDirection(cell));
+			}
+		}
+
+		if (target->raster(0, y, width, 1, row.data(), width, 1)) {
+			throw std::runtime_error("FlowDirection: Failed to write directions!");
+		}
+	}
+}
+
+std::string Plugin::getConditioningName(Conditioning conditioning) {
+	return conditioning == Conditioning::FillDepressions ? "filled" : "raw";
+}
+
+std::string Plugin::getFilledTerrainPath(const std::string& directions) {
+	std::filesystem::path path(directions);
+
+	return (path.parent_path() / (path.stem().string() + "_filled" + path.extension().string())).string();
+}
+
+void Plugin::copyTerrain(RASTER_BAND& source, RASTER_BAND& target) {
+	int width = source->getXSize(), height = source->getYSize();
+
+	std::vector<float> row(width);
+
+	for (int y = 0; y < height; y++) {
+		if (source->rasterFloat(0, y, width, 1, row.data(), width, 1)) {
+			throw std::runtime_error("DepressionFilling: Failed to read terrain!");
 		}
 
-		counter.fetch_add(1, std::memory_order_relaxed);
+		if (target->raster(0, y, width, 1, row.data(), width, 1)) {
+			throw std::runtime_error("DepressionFilling: Failed to write terrain!");
+		}
+	}
+}
+
+void Plugin::copyAccumulation(RASTER_BAND& source, RASTER_BAND& target) {
+	int width = source->getXSize(), height = source->getYSize();
+
+	// Windows of whole blocks, every compressed block is written once
+	int blockWidth, blockHeight;
+	target->getBlockSize(&blockWidth, &blockHeight);
+
+	int rows = max(blockHeight, 1);
+	int columns = min(max(blockWidth, (1 << 24) / rows / blockWidth * blockWidth), width);
+	std::vector<uint32_t> window(size_t(columns) * rows);
+
+	for (int y = 0; y < height; y += rows) {
+		for (int x = 0; x < width; x += columns) {
+			int windowWidth = min(columns, width - x), windowHeight = min(rows, height - y);
+
+			if (source->rasterUInt32(x, y, windowWidth, windowHeight, window.data(), windowWidth, windowHeight)) {
+				throw std::runtime_error("FlowAccumulation: Failed to read accumulation!");
+			}
+
+			if (target->raster(x, y, windowWidth, windowHeight, window.data(), windowWidth, windowHeight)) {
+				throw std::runtime_error("FlowAccumulation: Failed to write accumulation!");
+			}
+		}
 	}
 }
 
+void Plugin::printStatistics(const std::string& name, const CanvasStatistics& statistics) {
+	std::cout << name << " cache: " << statistics.hits << " hits, " << statistics.misses << " misses, " << statistics.prefetches << " prefetched, " << statistics.evictions << " evictions (" << statistics.writeBacks << " written back), " << statistics.writes << " band writes, " << statistics.slots << " slots" << std::endl;
+}
+
+void Plugin::setAccumulationMode(AccumulationMode mode) {
+	accumulationMode_ = mode;
+}
+
+AccumulationMode Plugin::getAccumulationMode() {
+	return accumulationMode_;
+}
+
+void Plugin::setConditioning(Conditioning conditioning) {
+	conditioning_ = conditioning;
+}
+
+void Plugin::setMemoryBudget(size_t bytes) {
+	memoryBudget_ = bytes;
+}
+
+void Plugin::setCreationProfile(const CreationProfile& profile) {
+	creationProfile_ = profile;
+}
+
+void Plugin::setArtifactCache(const std::string& directory, size_t bytes) {
+	cacheDirectory_ = directory;
+	cacheLimit_ = bytes;
+}
+
+void Plugin::setDirectionsOutput(const std::string& path) {
+	directionsOutput_ = path;
+}
+
+void Plugin::setTileSize(int width, int height) {
+	tileWidth_ = width;
+	tileHeight_ = height;
+}
+
+void Plugin::setPrefetch(int threadsCount, int depth) {
+	prefetchThreads_ = threadsCount;
+	prefetchDepth_ = depth;
+}
+
 int Plugin::getProgress() {
 	return progressCallback_ ? progressCallback_() : 0;
 }
 
+const RunReport& Plugin::getReport() {
+	return report_;
+}
+
 EXPORT_API void Process(const char* name, const char* output, int threadsCount) {
 	try {
 		Plugin::getInstance().process(name, output, threadsCount);
@@ -472,6 +1172,121 @@ EXPORT_API void Process(const char* name, const char* output, int threadsCount)
 	}
 }
 
+// Tile jobs return zero once done, the coordinator merges a stage after all of its workers have succeeded
+EXPORT_API int CreateJob(const char* name, const char* output, const char* directory) {
+	try {
+		Plugin::getInstance().createJob(name, output, directory);
+	}
+	catch (const std::exception& exception) {
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+EXPORT_API int RunJobWorker(const char* directory, int stage, int worker, int workersCount, int threadsCount) {
+	try {
+		Plugin::getInstance().runJobWorker(directory, stage, worker, workersCount, threadsCount);
+	}
+	catch (const std::exception& exception) {
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+EXPORT_API int RunJob(const char* name, const char* output, const char* directory, int workersCount, int threadsCount) {
+	try {
+		Plugin::getInstance().runJob(name, output, directory, workersCount, threadsCount);
+	}
+	catch (const std::exception& exception) {
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+EXPORT_API int MergeJob(const char* directory, int stage, int threadsCount) {
+	try {
+		Plugin::getInstance().mergeJob(directory, stage, threadsCount);
+	}
+	catch (const std::exception& exception) {
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+// Updates the directions and the accumulation of a run made with SetDirectionsOutput after the window of the terrain was edited
+// A run with filled depressions saves the filled terrain next to the directions, that one is edited and passed instead
+EXPORT_API int UpdateProcess(const char* name, const char* directions, const char* accumulation, int x, int y, int width, int height) {
+	try {
+		Plugin::getInstance().update(name, directions, accumulation, x, y, width, height);
+	}
+	catch (const std::exception& exception) {
+		std::cout << "<b>---------------- IncrementalUpdate Failed! ----------------</b>" << std::endl;
+		std::cout << "<b>Exception:</b> " << exception.what() << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+EXPORT_API void SetAccumulationMode(int mode) {
+	Plugin::getInstance().setAccumulationMode(mode == int(AccumulationMode::Tiled) ? AccumulationMode::Tiled : AccumulationMode::Paths);
+}
+
+EXPORT_API void SetConditioning(int conditioning) {
+	Plugin::getInstance().setConditioning((Conditioning)conditioning);
+}
+
+EXPORT_API void SetMemoryBudget(int megabytes) {
+	Plugin::getInstance().setMemoryBudget(size_t(max(megabytes, 0)) * 1024 * 1024);
+}
+
+EXPORT_API void SetCreationProfile(int blockSize, const char* compression, int threads) {
+	Plugin::getInstance().setCreationProfile({ max(blockSize, 0), compression ? compression : "", max(threads, 0) });
+}
+
+// Directions and sources are reused by runs over the same terrain, the cache is disabled if directory is empty
+EXPORT_API void SetArtifactCache(const char* directory, int megabytes) {
+	Plugin::getInstance().setArtifactCache(directory ? directory : "", size_t(max(megabytes, 0)) * 1024 * 1024);
+}
+
+EXPORT_API void SetDirectionsOutput(const char* path) {
+	Plugin::getInstance().setDirectionsOutput(path ? path : "");
+}
+
+EXPORT_API void SetTileSize(int width, int height) {
+	Plugin::getInstance().setTileSize(max(width, 0), max(height, 0));
+}
+
+// Tiles read ahead of the workers on dedicated I/O threads, prefetching is off if threadsCount is zero
+EXPORT_API void SetPrefetch(int threadsCount, int depth) {
+	Plugin::getInstance().setPrefetch(max(threadsCount, 0), max(depth, 1));
+}
+
 EXPORT_API int GetProgress() {
 	return Plugin::getInstance().getProgress();
+}
+
+// Counters of the phases of the last run as JSON, see Statistics. Returns the size the buffer needs with the terminator,
+// the buffer is filled only if it is large enough.
+EXPORT_API int GetStats(char* buffer, int size) {
+	std::string json = Statistics::getInstance().toJson();
+
+	if (buffer && size > int(json.size())) {
+		memcpy(buffer, json.c_str(), json.size() + 1);
+	}
+
+	return int(json.size() + 1);
 }
\ No newline at end of file
@@ -5,19 +5,44 @@
 #include "TempManager.h"
 #include <functional>
 #include "Canvas.h"
+#include "FlatResolver.h"
+#include "FlowCell.h"
+#include "SourcesList.h"
 
 typedef std::shared_ptr<Canvas<float>> CANVAS_FLOAT;
-typedef std::shared_ptr<Canvas<int8_t>> CANVAS_BYTE;
+typedef std::shared_ptr<Canvas<uint8_t>> CANVAS_BYTE;
 typedef std::shared_ptr<Canvas<uint32_t>> CANVAS_UINT32;
-typedef std::pair<size_t, size_t> CHUNK_BORDERS;
+
+// Values of SetAccumulationMode, any other one runs the paths
+enum class AccumulationMode {
+	Paths = 0, // Walks from the sources in Kahn's order, the last walker to reach a confluence carries on
+	Tiled = 2
+};
+
+enum class Conditioning {
+	None,
+	FillDepressions
+};
+
+struct PhaseReport {
+	std::string name;
+	double seconds = 0;
+	size_t cells = 0;
+};
+
+// Measurements of the last run for benchmarks, phases in the order they ran
+struct RunReport {
+	std::vector<PhaseReport> phases;
+	int width = 0;
+	int height = 0;
+	size_t peakWorkingSet = 0;
+	size_t peakTempBytes = 0; // Sampled at the end of every phase
+	bool cached = false;
+	bool succeeded = false;
+};
 
 class Plugin {
 public:
-	struct Source {
-		int x;
-		int y;
-	};
-
 	static Plugin& getInstance() {
 		static Plugin plugin;
 
@@ -26,21 +51,73 @@ public:
 
 	int getDirection(int i, int j);
 	void getOffsets(int direction, int* i, int* j);
-	int calculateFlowDirection(CANVAS_FLOAT& terrain, int x, int y, int index);
 	int calculateEnters(CANVAS_BYTE& directions, int x, int y, int index);
+	int calculateEnters(const uint8_t* cell, int stride);
 
 	void process(const std::string& name, const std::string& output, int threadsCount);
 
+	// Incremental update of a previous run after an edit of the terrain in the window, see IncrementalUpdater
+	void update(const std::string& name, const std::string& directions, const std::string& accumulation, int x, int y, int width, int height);
+
+	// Tile jobs run by worker processes, see TileJob
+	void createJob(const std::string& name, const std::string& output, const std::string& directory);
+	void runJobWorker(const std::string& directory, int stage, int worker, int workersCount, int threadsCount);
+	void mergeJob(const std::string& directory, int stage, int threadsCount);
+
+	// Creates the job and runs its stages by worker processes of the console runner, merging each one
+	void runJob(const std::string& name, const std::string& output, const std::string& directory, int workersCount, int threadsCount);
+
+	void setAccumulationMode(AccumulationMode mode);
+	AccumulationMode getAccumulationMode();
+	void setConditioning(Conditioning conditioning);
+	void setMemoryBudget(size_t bytes);
+	void setCreationProfile(const CreationProfile& profile);
+	void setArtifactCache(const std::string& directory, size_t bytes);
+	void setDirectionsOutput(const std::string& path);
+	void setTileSize(int width, int height);
+	void setPrefetch(int threadsCount, int depth);
+
 	int getProgress();
+	const RunReport& getReport();
 
 private:
 	Plugin() = default;
 
-	void directionProcess(CANVAS_FLOAT& terrain, CANVAS_BYTE& directions, int width, int height, int index, std::fstream& sourcesFile, int threadsCount);
-	void accumulationProcess(CANVAS_UINT32& accumulation, CANVAS_BYTE& directions, int index, std::fstream& sourcesFile, CHUNK_BORDERS& chunk, int threadsCount, size_t totalSourceCount);
+	void printStatistics(const std::string& name, const CanvasStatistics& statistics);
+	void copyDirections(RASTER_BAND& source, RASTER_BAND& target, bool codesOnly);
+	void copyTerrain(RASTER_BAND& source, RASTER_BAND& target);
+	void copyAccumulation(RASTER_BAND& source, RASTER_BAND& target);
+
+	// Conditioning of the terrain the saved directions were computed from, the filled terrain is saved next to them
+	static constexpr const char* CONDITIONING_ITEM = "WATERCOURSE_CONDITIONING";
+
+	static std::string getConditioningName(Conditioning conditioning);
+	static std::string getFilledTerrainPath(const std::string& directions);
+
+	void readTerrainTile(RASTER_BAND& terrainBand, int width, int height, int rowOffset, int rows, std::vector<float>& tile);
+	void directionProcess(RASTER_BAND& terrainBand, RASTER_BAND& directionsBand, CANVAS_BYTE& directions, PREFETCHER& prefetcher, int width, int height, int index, FlatResolver& flats, SourcesList& sources, int threadsCount);
+	void accumulationProcess(CANVAS_UINT32& accumulation, CANVAS_BYTE& directions, int index, const SourcesChunk& chunk, int threadsCount);
 
 	std::optional<double> terrainNoData_;
-	std::optional<int> directionNoData_ = 64;
+	std::optional<int> directionNoData_ = FlowCell::NO_DATA;
+
+	AccumulationMode accumulationMode_ = AccumulationMode::Paths;
+	Conditioning conditioning_ = Conditioning::None;
+	size_t memoryBudget_ = 0; // Available physical memory if zero
+	CreationProfile creationProfile_;
+	std::string directionsOutput_; // Not saved if empty
+	std::string cacheDirectory_; // No cache if empty
+	size_t cacheLimit_ = 0;
+
+	int tileWidth_ = 0; // Canvas default if zero
+	int tileHeight_ = 0;
+
+	int prefetchThreads_ = 2; // I/O threads reading ahead, none if zero
+	int prefetchDepth_ = 2;
 
 	std::function<int()> progressCallback_;
+	std::atomic_int64_t accumulatedSources_ = 0; // Progress of the accumulation phase
+	std::atomic_int nextDirectionRow_ = 0; // Work of the direction phase handed out to its threads
+	std::atomic_int nextSourceSlot_ = 0;
+	RunReport report_;
 };
\ No newline at end of file
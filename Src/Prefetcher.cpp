@@ -0,0 +1,75 @@
+#include "pch.h"
+
+#include "Prefetcher.h"
+
+Prefetcher::Prefetcher(int threadsCount, int depth, size_t queueLimit) : depth_(max(depth, 1)), queueLimit_(queueLimit) {
+	if (threadsCount <= 0) {
+		throw std::runtime_error("Prefetcher: Invalid threads count!");
+	}
+
+	for (int i = 0; i < threadsCount; i++) {
+		threads_.emplace_back(&Prefetcher::run, this);
+	}
+}
+
+Prefetcher::~Prefetcher() {
+	{
+		std::unique_lock lock(mutex_);
+
+		stopping_ = true;
+		tasks_.clear();
+	}
+
+	cv_.notify_all();
+
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+bool Prefetcher::submit(std::function<void()> task) {
+	{
+		std::unique_lock lock(mutex_);
+
+		if (stopping_ || tasks_.size() >= queueLimit_) {
+			return false;
+		}
+
+		tasks_.push_back(std::move(task));
+	}
+
+	cv_.notify_one();
+
+	return true;
+}
+
+int Prefetcher::getDepth() {
+	return depth_;
+}
+
+void Prefetcher::run() {
+	while (true) {
+		std::function<void()> task;
+
+		{
+			std::unique_lock lock(mutex_);
+
+			cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+
+			if (stopping_) {
+				return;
+			}
+
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+		}
+
+		// Packaged tasks hand their exceptions to the futures, failed hints are the worker's to redo
+		try {
+			task();
+		}
+		catch (...) {
+
+		}
+	}
+}
\ No newline at end of file
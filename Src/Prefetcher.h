@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Dedicated I/O threads reading tiles ahead of the workers. Requests are hints: they are refused once the queue holds
+// queueLimit of them, and the ones still queued when the prefetcher is destroyed are dropped.
+class Prefetcher {
+public:
+	Prefetcher(int threadsCount, int depth, size_t queueLimit = 256);
+	~Prefetcher();
+
+	Prefetcher(const Prefetcher&) = delete;
+	Prefetcher& operator=(const Prefetcher&) = delete;
+
+	// False if the task was refused, the caller then does the work itself or gives it up
+	bool submit(std::function<void()> task);
+
+	// Tiles or bands to read ahead of each worker
+	int getDepth();
+
+private:
+	void run();
+
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> tasks_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stopping_ = false;
+
+	int depth_ = 0;
+	size_t queueLimit_ = 0;
+};
+
+typedef std::shared_ptr<Prefetcher> PREFETCHER;
\ No newline at end of file
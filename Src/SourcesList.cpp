@@ -0,0 +1,162 @@
+#include "pch.h"
+
+#include "SourcesList.h"
+
+#include <algorithm>
+
+// Interleaves the bits of x and y, 16 of each
+static uint32_t getMortonCode(uint32_t x, uint32_t y) {
+	auto spread = [](uint32_t value) {
+		value &= 0xFFFF;
+		value = (value | (value << 8)) & 0x00FF00FF;
+		value = (value | (value << 4)) & 0x0F0F0F0F;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+
+		return value;
+	};
+
+	return spread(x) | (spread(y) << 1);
+}
+
+SourcesList::SourcesList(TempManager& temp, int partsCount, MEMORY_BUDGET budget, int tileWidth, int tileHeight) : temp_(temp), parts_(partsCount), budget_(budget), tileWidth_(min(max(tileWidth, 1), 65536)), tileHeight_(min(max(tileHeight, 1), 65536)) {
+	// An eighth of the budget for all parts kept in RAM, the rest is left for the canvases
+	partLimit_ = max(budget_->getLimit() / 8 / partsCount / sizeof(Source), size_t(64 * 1024));
+}
+
+SourcesList::~SourcesList() {
+	for (int i = 0; i < int(parts_.size()); i++) {
+		if (parts_[i].mapping) {
+			parts_[i].mapping.reset();
+
+			temp_.deleteFile("source_" + std::to_string(i));
+		}
+	}
+
+	budget_->release(acquired_);
+}
+
+void SourcesList::setTileSize(int tileWidth, int tileHeight) {
+	tileWidth_ = min(max(tileWidth, 1), 65536);
+	tileHeight_ = min(max(tileHeight, 1), 65536);
+}
+
+void SourcesList::push(int part, const Source& source) {
+	auto& buffer = parts_[part].buffer;
+
+	buffer.push_back(source);
+
+	if (buffer.size() >= partLimit_) {
+		spill(part);
+	}
+}
+
+void SourcesList::completePart(int part) {
+	sort(parts_[part].buffer);
+}
+
+void SourcesList::spill(int index) {
+	auto& part = parts_[index];
+
+	sort(part.buffer);
+
+	if (!part.file.is_open()) {
+		part.file.open(temp_.addFile("source_" + std::to_string(index)), std::ios::binary | std::ios::out | std::ios::trunc);
+	}
+
+	part.file.write((const char*)part.buffer.data(), part.buffer.size() * sizeof(Source));
+	part.count += part.buffer.size();
+	part.buffer.clear();
+
+	if (!part.file) {
+		throw std::runtime_error("SourcesList: Failed to write sources!");
+	}
+}
+
+void SourcesList::finish() {
+	for (int i = 0; i < int(parts_.size()); i++) {
+		auto& part = parts_[i];
+
+		if (part.file.is_open()) {
+			spill(i);
+
+			part.file.close();
+			part.buffer = std::vector<Source>();
+
+			part.mapping = std::make_unique<MappedFile>(temp_.getPath("source_" + std::to_string(i)));
+			part.data = (const Source*)part.mapping->data();
+		}
+		else {
+			part.buffer.shrink_to_fit();
+			part.count = part.buffer.size();
+			part.data = part.buffer.data();
+
+			acquired_ += part.count * sizeof(Source);
+		}
+	}
+
+	budget_->acquire(acquired_, true);
+}
+
+size_t SourcesList::size() {
+	size_t count = 0;
+
+	for (auto& part : parts_) {
+		count += part.count;
+	}
+
+	return count;
+}
+
+std::vector<SourcesChunk> SourcesList::split(size_t chunkSize) {
+	std::vector<SourcesChunk> chunks;
+
+	size_t offset = 0;
+
+	for (auto& part : parts_) {
+		for (size_t begin = 0; begin < part.count; begin += chunkSize) {
+			size_t count = min(chunkSize, part.count - begin);
+
+			chunks.push_back({ part.data + begin, count, offset + begin });
+		}
+
+		offset += part.count;
+	}
+
+	return chunks;
+}
+
+void SourcesList::save(const std::filesystem::path& path) {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+	for (auto& part : parts_) {
+		file.write((const char*)part.data, part.count * sizeof(Source));
+	}
+
+	if (!file) {
+		throw std::runtime_error("SourcesList: Failed to save sources!");
+	}
+}
+
+void SourcesList::load(const std::filesystem::path& path) {
+	loaded_ = std::make_unique<MappedFile>(path);
+
+	parts_[0].data = (const Source*)loaded_->data();
+	parts_[0].count = loaded_->size() / sizeof(Source);
+}
+
+void SourcesList::sort(std::vector<Source>& sources) {
+	std::sort(sources.begin(), sources.end(), [this](const Source& a, const Source& b) {
+		int tileYA = a.y / tileHeight_, tileYB = b.y / tileHeight_;
+		if (tileYA != tileYB) {
+			return tileYA < tileYB;
+		}
+
+		int tileXA = a.x / tileWidth_, tileXB = b.x / tileWidth_;
+		if (tileXA != tileXB) {
+			return tileXA < tileXB;
+		}
+
+		return getMortonCode(a.x % tileWidth_, a.y % tileHeight_) < getMortonCode(b.x % tileWidth_, b.y % tileHeight_);
+		});
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "MappedFile.h"
+#include "MemoryBudget.h"
+#include "TempManager.h"
+
+struct Source {
+	int x;
+	int y;
+};
+
+// Contiguous run of sources handed to a thread without copying
+struct SourcesChunk {
+	const Source* data = nullptr;
+	size_t count = 0;
+	size_t offset = 0; // Position of the first source in the whole list
+};
+
+// Sources collected in parts, one per thread. A part stays in RAM while it fits into its share of the budget,
+// otherwise it is spilled to its own temp file and memory mapped once finished. The parts are concatenated by offset.
+// Parts are ordered by tiles of tileWidth x tileHeight cells and in Z-order inside the tiles, so consecutive walks
+// of the accumulation start from the same canvas slots. Spilled parts are ordered run by run.
+class SourcesList {
+public:
+	SourcesList(TempManager& temp, int partsCount, MEMORY_BUDGET budget, int tileWidth = 1024, int tileHeight = 1024);
+	~SourcesList();
+
+	// The slot geometry of the canvas the walks start from, must be set before the first push
+	void setTileSize(int tileWidth, int tileHeight);
+
+	void push(int part, const Source& source);
+
+	// Orders the rest of the part, called by its thread once it has pushed everything
+	void completePart(int part);
+
+	// Must be called once every part is complete, before split()
+	void finish();
+
+	size_t size();
+	std::vector<SourcesChunk> split(size_t chunkSize);
+
+	// Whole list in one file, loading maps it instead of the pushes and finish()
+	void save(const std::filesystem::path& path);
+	void load(const std::filesystem::path& path);
+
+private:
+	struct Part {
+		std::vector<Source> buffer;
+		std::fstream file;
+		std::unique_ptr<MappedFile> mapping;
+
+		const Source* data = nullptr;
+		size_t count = 0;
+	};
+
+	void spill(int index);
+	void sort(std::vector<Source>& sources);
+
+	TempManager& temp_;
+	std::vector<Part> parts_;
+	std::unique_ptr<MappedFile> loaded_; // Not a temp file, kept apart from the parts
+
+	MEMORY_BUDGET budget_;
+	size_t partLimit_ = 0;
+	size_t acquired_ = 0;
+
+	int tileWidth_ = 0;
+	int tileHeight_ = 0;
+};
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "pch.h"
+
+#include "Statistics.h"
+
+#include <sstream>
+
+void Statistics::reset() {
+	std::unique_lock lock(mutex_);
+
+	phases_.clear();
+	phase_.clear();
+
+	clear();
+}
+
+void Statistics::beginPhase(const std::string& name) {
+	std::unique_lock lock(mutex_);
+
+	clear();
+
+	phase_ = name;
+	phaseStart_ = std::chrono::steady_clock::now();
+}
+
+void Statistics::endPhase() {
+	std::unique_lock lock(mutex_);
+
+	if (phase_.empty()) {
+		return;
+	}
+
+	phases_.push_back(snapshot());
+	phase_.clear();
+
+	clear();
+}
+
+void Statistics::addRead(size_t bytes) {
+	bytesRead_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Statistics::addWritten(size_t bytes) {
+	bytesWritten_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Statistics::addWait(WaitPoint point, std::chrono::steady_clock::duration duration) {
+	waitNanoseconds_[size_t(point)].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+	waits_[size_t(point)].fetch_add(1, std::memory_order_relaxed);
+}
+
+int Statistics::attachCanvas(std::function<CanvasStatistics()> source) {
+	std::unique_lock lock(mutex_);
+
+	int id = nextCanvas_++;
+	canvases_[id] = { source, CanvasStatistics() };
+
+	return id;
+}
+
+void Statistics::detachCanvas(int id) {
+	std::unique_lock lock(mutex_);
+
+	auto canvas = canvases_.find(id);
+
+	if (canvas == canvases_.end()) {
+		return;
+	}
+
+	CanvasStatistics statistics = canvas->second.read();
+	const CanvasStatistics& baseline = canvas->second.baseline;
+
+	slotHits_.fetch_add(statistics.hits - baseline.hits, std::memory_order_relaxed);
+	slotMisses_.fetch_add(statistics.misses - baseline.misses, std::memory_order_relaxed);
+	slotEvictions_.fetch_add(statistics.evictions - baseline.evictions, std::memory_order_relaxed);
+	slotWriteBacks_.fetch_add(statistics.writeBacks - baseline.writeBacks, std::memory_order_relaxed);
+	slotPrefetches_.fetch_add(statistics.prefetches - baseline.prefetches, std::memory_order_relaxed);
+
+	canvases_.erase(canvas);
+}
+
+void Statistics::addThreadCells(int index, size_t cells) {
+	if (index >= 0 && index < MAX_THREADS) {
+		threads_[index].cells.fetch_add(cells, std::memory_order_relaxed);
+	}
+}
+
+void Statistics::addThreadTime(int index, double seconds) {
+	if (index >= 0 && index < MAX_THREADS) {
+		threads_[index].nanoseconds.fetch_add(int64_t(seconds * 1e9), std::memory_order_relaxed);
+	}
+}
+
+std::vector<PhaseStatistics> Statistics::getPhases() {
+	std::unique_lock lock(mutex_);
+
+	std::vector<PhaseStatistics> phases = phases_;
+
+	if (!phase_.empty()) {
+		phases.push_back(snapshot());
+	}
+
+	return phases;
+}
+
+std::string Statistics::toJson() {
+	std::ostringstream json;
+	json << "{\"phases\":[";
+
+	auto phases = getPhases();
+
+	for (size_t i = 0; i < phases.size(); i++) {
+		const PhaseStatistics& phase = phases[i];
+
+		json << (i ? "," : "") << "{\"name\":\"" << phase.name << "\",\"seconds\":" << phase.seconds;
+		json << ",\"slots\":{\"hits\":" << phase.slotHits << ",\"misses\":" << phase.slotMisses << ",\"evictions\":" << phase.slotEvictions << ",\"writeBacks\":" << phase.slotWriteBacks << ",\"prefetches\":" << phase.slotPrefetches << "}";
+		json << ",\"io\":{\"bytesRead\":" << phase.bytesRead << ",\"bytesWritten\":" << phase.bytesWritten << "}";
+		json << ",\"waits\":{";
+
+		for (size_t point = 0; point < size_t(WaitPoint::Count); point++) {
+			json << (point ? "," : "") << "\"" << getWaitPointName(WaitPoint(point)) << "\":{\"seconds\":" << phase.waitSeconds[point] << ",\"count\":" << phase.waits[point] << "}";
+		}
+
+		json << "},\"threads\":[";
+
+		for (size_t thread = 0; thread < phase.threads.size(); thread++) {
+			const ThreadStatistics& statistics = phase.threads[thread];
+			double cellsPerSecond = statistics.seconds > 0 ? statistics.cells / statistics.seconds : 0;
+
+			json << (thread ? "," : "") << "{\"cells\":" << statistics.cells << ",\"seconds\":" << statistics.seconds << ",\"cellsPerSecond\":" << size_t(cellsPerSecond) << "}";
+		}
+
+		json << "]}";
+	}
+
+	json << "]}";
+
+	return json.str();
+}
+
+const char* Statistics::getWaitPointName(WaitPoint point) {
+	switch (point) {
+	case WaitPoint::Slots:
+		return "slots";
+	case WaitPoint::Chunks:
+		return "chunks";
+	case WaitPoint::Barrier:
+		return "barrier";
+	case WaitPoint::Gdal:
+		return "gdal";
+	default:
+		return "";
+	}
+}
+
+PhaseStatistics Statistics::snapshot() {
+	PhaseStatistics phase;
+
+	phase.name = phase_;
+	phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - phaseStart_).count();
+
+	phase.slotHits = slotHits_.load(std::memory_order_relaxed);
+	phase.slotMisses = slotMisses_.load(std::memory_order_relaxed);
+	phase.slotEvictions = slotEvictions_.load(std::memory_order_relaxed);
+	phase.slotWriteBacks = slotWriteBacks_.load(std::memory_order_relaxed);
+	phase.slotPrefetches = slotPrefetches_.load(std::memory_order_relaxed);
+
+	for (auto& [id, canvas] : canvases_) {
+		CanvasStatistics statistics = canvas.read();
+
+		phase.slotHits += statistics.hits - canvas.baseline.hits;
+		phase.slotMisses += statistics.misses - canvas.baseline.misses;
+		phase.slotEvictions += statistics.evictions - canvas.baseline.evictions;
+		phase.slotWriteBacks += statistics.writeBacks - canvas.baseline.writeBacks;
+		phase.slotPrefetches += statistics.prefetches - canvas.baseline.prefetches;
+	}
+
+	phase.bytesRead = bytesRead_.load(std::memory_order_relaxed);
+	phase.bytesWritten = bytesWritten_.load(std::memory_order_relaxed);
+
+	for (size_t point = 0; point < size_t(WaitPoint::Count); point++) {
+		phase.waitSeconds[point] = waitNanoseconds_[point].load(std::memory_order_relaxed) / 1e9;
+		phase.waits[point] = waits_[point].load(std::memory_order_relaxed);
+	}
+
+	// Trailing idle threads are cut off
+	for (int i = 0; i < MAX_THREADS; i++) {
+		size_t cells = threads_[i].cells.load(std::memory_order_relaxed);
+		int64_t nanoseconds = threads_[i].nanoseconds.load(std::memory_order_relaxed);
+
+		if (cells || nanoseconds) {
+			phase.threads.resize(i + 1);
+			phase.threads[i] = { cells, nanoseconds / 1e9 };
+		}
+	}
+
+	return phase;
+}
+
+void Statistics::clear() {
+	slotHits_ = 0;
+	slotMisses_ = 0;
+	slotEvictions_ = 0;
+	slotWriteBacks_ = 0;
+	slotPrefetches_ = 0;
+
+	for (auto& [id, canvas] : canvases_) {
+		canvas.baseline = canvas.read();
+	}
+
+	bytesRead_ = 0;
+	bytesWritten_ = 0;
+
+	for (size_t point = 0; point < size_t(WaitPoint::Count); point++) {
+		waitNanoseconds_[point] = 0;
+		waits_[point] = 0;
+	}
+
+	for (auto& thread : threads_) {
+		thread.cells = 0;
+		thread.nanoseconds = 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class WaitPoint {
+	Slots,   // Canvas slot table
+	Chunks,  // Accumulation chunk queue
+	Barrier, // Thread barriers between the stages of a phase
+	Gdal,    // GdalRasterBand I/O lock
+	Count
+};
+
+// Slot switches of the users: hits are served from memory, misses are loaded from the band
+struct CanvasStatistics {
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;
+	size_t writeBacks = 0;
+	size_t prefetches = 0; // Loads made ahead on the I/O threads, not counted as misses
+	size_t writes = 0; // Band writes, adjacent dirty tiles are merged into one
+	size_t slots = 0;
+};
+
+struct ThreadStatistics {
+	size_t cells = 0;
+	double seconds = 0;
+};
+
+struct PhaseStatistics {
+	std::string name;
+	double seconds = 0;
+
+	size_t slotHits = 0;
+	size_t slotMisses = 0;
+	size_t slotEvictions = 0;
+	size_t slotWriteBacks = 0;
+	size_t slotPrefetches = 0;
+
+	size_t bytesRead = 0;
+	size_t bytesWritten = 0;
+
+	double waitSeconds[size_t(WaitPoint::Count)] = {};
+	size_t waits[size_t(WaitPoint::Count)] = {}; // Contended acquisitions only
+
+	std::vector<ThreadStatistics> threads; // By thread index, idle threads are zero
+};
+
+// Process-wide counters of the running phase, kept as relaxed atomics so they stay on in production.
+// Hot paths add whole rows or tiles at once, locks are timed only when they are contended.
+class Statistics {
+public:
+	static Statistics& getInstance() {
+		static Statistics statistics;
+
+		return statistics;
+	}
+
+	static constexpr int MAX_THREADS = 256;
+
+	// Drops the phases of the previous run
+	void reset();
+
+	// Counters outside of phases aren't reported
+	void beginPhase(const std::string& name);
+	void endPhase();
+
+	void addRead(size_t bytes);
+	void addWritten(size_t bytes);
+	void addWait(WaitPoint point, std::chrono::steady_clock::duration duration);
+
+	// Live canvases are read by the snapshots, so a running phase reports their current counters. Returns the id to detach.
+	int attachCanvas(std::function<CanvasStatistics()> source);
+	// The counters of the canvas stay with the running phase
+	void detachCanvas(int id);
+
+	void addThreadCells(int index, size_t cells);
+	void addThreadTime(int index, double seconds);
+
+	// Finished phases and the running one
+	std::vector<PhaseStatistics> getPhases();
+	std::string toJson();
+
+	static const char* getWaitPointName(WaitPoint point);
+
+	// Takes the lock, the time is measured only if it is held by someone else
+	template<typename Lock>
+	static std::unique_lock<Lock> lock(Lock& mutex, WaitPoint point) {
+		std::unique_lock<Lock> lock(mutex, std::try_to_lock);
+
+		if (!lock.owns_lock()) {
+			auto start = std::chrono::steady_clock::now();
+
+			lock.lock();
+
+			getInstance().addWait(point, std::chrono::steady_clock::now() - start);
+		}
+
+		return lock;
+	}
+
+private:
+	struct Source {
+		std::function<CanvasStatistics()> read;
+		CanvasStatistics baseline; // Counters before the running phase
+	};
+
+	struct alignas(64) Thread {
+		std::atomic<size_t> cells{ 0 };
+		std::atomic<int64_t> nanoseconds{ 0 };
+	};
+
+	Statistics() = default;
+
+	PhaseStatistics snapshot();
+	void clear();
+
+	std::mutex mutex_; // Phases and the name of the running one
+	std::vector<PhaseStatistics> phases_;
+	std::string phase_;
+	std::chrono::steady_clock::time_point phaseStart_;
+	std::map<int, Source> canvases_;
+	int nextCanvas_ = 0;
+
+	std::atomic<size_t> slotHits_{ 0 };
+	std::atomic<size_t> slotMisses_{ 0 };
+	std::atomic<size_t> slotEvictions_{ 0 };
+	std::atomic<size_t> slotWriteBacks_{ 0 };
+	std::atomic<size_t> slotPrefetches_{ 0 };
+
+	std::atomic<size_t> bytesRead_{ 0 };
+	std::atomic<size_t> bytesWritten_{ 0 };
+
+	std::atomic<int64_t> waitNanoseconds_[size_t(WaitPoint::Count)] = {};
+	std::atomic<size_t> waits_[size_t(WaitPoint::Count)] = {};
+
+	Thread threads_[MAX_THREADS];
+};
+
+// Ends the phase on every way out of the scope, so a failed phase is reported and the next one starts clean
+class StatisticsPhase {
+public:
+	StatisticsPhase(const std::string& name) {
+		Statistics::getInstance().beginPhase(name);
+	}
+
+	~StatisticsPhase() {
+		end();
+	}
+
+	StatisticsPhase(const StatisticsPhase&) = delete;
+	StatisticsPhase& operator=(const StatisticsPhase&) = delete;
+
+	void end() {
+		if (!ended_) {
+			ended_ = true;
+			Statistics::getInstance().endPhase();
+		}
+	}
+
+private:
+	bool ended_ = false;
+};
\ No newline at end of file
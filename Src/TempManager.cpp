@@ -14,14 +14,20 @@ TempManager::~TempManager() {
 }
 
 std::filesystem::path TempManager::addFile(const std::string& key) {
+	std::unique_lock lock(mutex_);
+
 	return tempFilesPaths_.find(key) == tempFilesPaths_.end() ? tempFilesPaths_[key] = generateRandomName() : tempFilesPaths_[key];
 }
 
 std::filesystem::path TempManager::getPath(const std::string& key) {
+	std::unique_lock lock(mutex_);
+
 	return tempFilesPaths_.at(key);
 }
 
 void TempManager::deleteFile(const std::string& key) {
+	std::unique_lock lock(mutex_);
+
 	std::filesystem::remove(tempFilesPaths_[key]);
 	tempFilesPaths_.erase(key);
 }
@@ -40,5 +46,24 @@ std::string TempManager::generateRandomName(const std::string& prefix, const std
 }
 
 void TempManager::makeNonTemp(const std::string& key) {
+	std::unique_lock lock(mutex_);
+
 	tempFilesPaths_.erase(key);
+}
+
+size_t TempManager::getSize() {
+	std::unique_lock lock(mutex_);
+
+	size_t size = 0;
+
+	for (const auto& path : tempFilesPaths_) {
+		std::error_code error;
+		uintmax_t fileSize = std::filesystem::file_size(path.second, error);
+
+		if (!error) {
+			size += size_t(fileSize);
+		}
+	}
+
+	return size;
 }
\ No newline at end of file
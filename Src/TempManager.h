@@ -2,7 +2,9 @@
 
 #include <filesystem>
 #include <map>
+#include <mutex>
 
+// Paths of the temp files by key, removed with the manager. Files may be added from several threads.
 class TempManager {
 public:
 	~TempManager();
@@ -13,6 +15,10 @@ public:
 	std::string generateRandomName(const std::string& prefix = "file_", const std::string& suffix = ".tmp");
 	void makeNonTemp(const std::string& key);
 
+	// Total size of the temp files on disk
+	size_t getSize();
+
 private:
 	std::map<std::string, std::filesystem::path> tempFilesPaths_;
+	std::mutex mutex_;
 };
\ No newline at end of file
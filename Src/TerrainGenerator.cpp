@@ -0,0 +1,127 @@
+#include "pch.h"
+
+#include "TerrainGenerator.h"
+
+#include <cmath>
+#include <vector>
+
+#include "Canvas.h"
+#include "GdalTiffReader.h"
+
+TerrainGenerator::TerrainGenerator(TerrainKind kind, int width, int height, unsigned seed) : kind_(kind), width_(width), height_(height), seed_(seed) {
+	if (width <= 0 || height <= 0) {
+		throw std::runtime_error("TerrainGenerator: Invalid size!");
+	}
+}
+
+void TerrainGenerator::generate(const std::string& fileName) {
+	GEOTIFF_READER reader(new GdalTiffReader(fileName, width_, height_, 1, RasterDataType::Float32));
+	RASTER_BAND band(reader->getRasterBand(1));
+
+	band->setNoDataValue(NO_DATA);
+
+	std::vector<float> row(width_);
+
+	for (int y = 0; y < height_; y++) {
+		for (int x = 0; x < width_; x++) {
+			row[x] = getHeight(x, y);
+		}
+
+		if (band->raster(0, y, width_, 1, row.data(), width_, 1)) {
+			throw std::runtime_error("TerrainGenerator: Failed to write terrain!");
+		}
+	}
+}
+
+bool TerrainGenerator::needsFilling() {
+	return kind_ == TerrainKind::Fractal || kind_ == TerrainKind::Coast;
+}
+
+TerrainKind TerrainGenerator::parseKind(const std::string& name) {
+	for (TerrainKind kind : { TerrainKind::Plane, TerrainKind::Fractal, TerrainKind::Flats, TerrainKind::Coast, TerrainKind::Valley }) {
+		if (name == getKindName(kind)) {
+			return kind;
+		}
+	}
+
+	throw std::runtime_error("TerrainGenerator: Unknown terrain kind " + name + "!");
+}
+
+const char* TerrainGenerator::getKindName(TerrainKind kind) {
+	switch (kind) {
+	case TerrainKind::Plane:
+		return "plane";
+	case TerrainKind::Fractal:
+		return "fractal";
+	case TerrainKind::Flats:
+		return "flats";
+	case TerrainKind::Coast:
+		return "coast";
+	case TerrainKind::Valley:
+		return "valley";
+	}
+
+	return "";
+}
+
+float TerrainGenerator::getHeight(int x, int y) {
+	// Below the gradient of the plane, so the noise never makes a pit
+	double jitter = getLatticeValue(x, y, 0) * 0.1;
+
+	switch (kind_) {
+	case TerrainKind::Plane:
+		return float(x * 0.3 + y * 0.7 + jitter);
+	case TerrainKind::Flats:
+		return float(std::floor((x * 0.3 + y * 0.7) / 64) * 10);
+	case TerrainKind::Fractal:
+		return float(getNoise(x, y) * 1000);
+	case TerrainKind::Coast: {
+		// Land rises away from the left edge, the sea covers about a half of the raster
+		double land = getNoise(x, y) - 0.5 + (double(x) / width_ - 0.5);
+
+		return land < 0 ? NO_DATA : float(land * 1000);
+	}
+	case TerrainKind::Valley:
+		// The channel runs down off the bottom edge, a bit off the middle so it doesn't follow a tile edge
+		return float(std::abs(x - width_ / 2 - 1) * 0.7 + (height_ - y) * 0.3 + jitter);
+	}
+
+	return NO_DATA;
+}
+
+double TerrainGenerator::getNoise(double x, double y) {
+	double scale = max(width_, height_) / 4.;
+	double amplitude = 0.5;
+	double noise = 0;
+
+	for (int octave = 1; octave <= 8 && scale >= 1; octave++) {
+		double u = x / scale, v = y / scale;
+		int i = int(std::floor(u)), j = int(std::floor(v));
+
+		double fu = u - i, fv = v - j;
+		fu = fu * fu * (3 - 2 * fu);
+		fv = fv * fv * (3 - 2 * fv);
+
+		double top = getLatticeValue(i, j, octave) * (1 - fu) + getLatticeValue(i + 1, j, octave) * fu;
+		double bottom = getLatticeValue(i, j + 1, octave) * (1 - fu) + getLatticeValue(i + 1, j + 1, octave) * fu;
+
+		noise += (top * (1 - fv) + bottom * fv) * amplitude;
+
+		amplitude /= 2;
+		scale /= 2;
+	}
+
+	return noise;
+}
+
+double TerrainGenerator::getLatticeValue(int x, int y, int octave) {
+	uint32_t hash = uint32_t(x) * 0x8da6b343u ^ uint32_t(y) * 0xd8163841u ^ uint32_t(octave) * 0xcb1ab31fu ^ seed_ * 0x165667b1u;
+
+	hash ^= hash >> 16;
+	hash *= 0x7feb352du;
+	hash ^= hash >> 15;
+	hash *= 0x846ca68bu;
+	hash ^= hash >> 16;
+
+	return (hash & 0xFFFFFF) / double(0xFFFFFF);
+}
\ No newline at end of file
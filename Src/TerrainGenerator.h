@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+enum class TerrainKind {
+	Plane,   // Tilted plane, every cell has a lower neighbour
+	Fractal, // Value noise with pits, needs filling
+	Flats,   // Wide terraces, most cells lie on flats
+	Coast,   // Fractal land with the sea as nodata, needs filling
+	Valley   // Slopes down to one channel, whole tile edges drain into single exits
+};
+
+// Synthetic terrains for benchmarks, written row by row so any size fits into memory
+class TerrainGenerator {
+public:
+	TerrainGenerator(TerrainKind kind, int width, int height, unsigned seed = 1);
+
+	// Float32 raster, nodata is NO_DATA
+	void generate(const std::string& fileName);
+
+	// Terrains with pits are processed with filled depressions
+	bool needsFilling();
+
+	static TerrainKind parseKind(const std::string& name);
+	static const char* getKindName(TerrainKind kind);
+
+	static constexpr float NO_DATA = -9999.f;
+
+private:
+	float getHeight(int x, int y);
+
+	// Fractal Brownian motion of value noise, about 0..1
+	double getNoise(double x, double y);
+	double getLatticeValue(int x, int y, int octave);
+
+	TerrainKind kind_;
+	int width_ = 0;
+	int height_ = 0;
+	unsigned seed_ = 1;
+};
\ No newline at end of file
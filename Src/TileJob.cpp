@@ -0,0 +1,525 @@
+#include "pch.h"
+
+#include "TileJob.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "DirectionKernel.h"
+#include "FlatResolver.h"
+#include "FlowCell.h"
+#include "TiledAccumulator.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
+
+// Runs body for the tiles of a worker, taken by threads from a shared counter
+static void forEachTile(const std::vector<size_t>& tiles, int threadsCount, const std::function<void(size_t)>& body) {
+	std::atomic<size_t> next{ 0 };
+	std::exception_ptr failure;
+	std::mutex failureMutex;
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadsCount);
+
+	for (int i = 0; i < threadsCount; i++) {
+		threads.emplace_back([&tiles, &body, &next, &failure, &failureMutex]() {
+			try {
+				for (size_t k = next++; k < tiles.size(); k = next++) {
+					body(tiles[k]);
+				}
+			}
+			catch (...) {
+				std::unique_lock lock(failureMutex);
+
+				if (!failure) {
+					failure = std::current_exception();
+				}
+
+				next = tiles.size();
+			}
+			});
+	}
+
+	for (auto& thread : threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	if (failure) {
+		std::rethrow_exception(failure);
+	}
+}
+
+static void writeFile(const std::filesystem::path& path, const void* data, size_t size) {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write((const char*)data, size);
+
+	if (!file) {
+		throw std::runtime_error("TileJob: Failed to write " + path.string() + "!");
+	}
+}
+
+template<typename T>
+static void readFile(const std::filesystem::path& path, std::vector<T>& data) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+	if (!file) {
+		throw std::runtime_error("TileJob: Failed to read " + path.string() + "!");
+	}
+
+	data.resize(size_t(file.tellg()) / sizeof(T));
+
+	file.seekg(0);
+	file.read((char*)data.data(), data.size() * sizeof(T));
+
+	if (!file) {
+		throw std::runtime_error("TileJob: Failed to read " + path.string() + "!");
+	}
+}
+
+TileJob::TileJob(const std::string& directory, MEMORY_BUDGET budget) : directory_(directory), budget_(budget) {
+	std::ifstream manifest(directory_ / "job.txt");
+
+	if (!manifest) {
+		throw std::runtime_error("TileJob: No job in " + directory + "!");
+	}
+
+	std::string line;
+
+	while (std::getline(manifest, line)) {
+		size_t separator = line.find('=');
+		std::string key = line.substr(0, separator);
+		std::string value = separator == std::string::npos ? "" : line.substr(separator + 1);
+
+		if (key == "terrain") {
+			terrain_ = value;
+		}
+		else if (key == "output") {
+			output_ = value;
+		}
+		else if (key == "width") {
+			width_ = std::stoi(value);
+		}
+		else if (key == "height") {
+			height_ = std::stoi(value);
+		}
+		else if (key == "tileWidth") {
+			tileWidth_ = std::stoi(value);
+		}
+		else if (key == "tileHeight") {
+			tileHeight_ = std::stoi(value);
+		}
+	}
+
+	if (terrain_.empty() || output_.empty() || width_ <= 0 || height_ <= 0 || tileWidth_ <= 0 || tileHeight_ <= 0) {
+		throw std::runtime_error("TileJob: Invalid job manifest!");
+	}
+
+	for (int j = -1, k = 0; j <= 1; j++) {
+		for (int i = -1; i <= 1; i++) {
+			if (i != 0 || j != 0) {
+				codes_[k++] = (j + 1) * 3 + (i + 1) + 1;
+			}
+		}
+	}
+}
+
+void TileJob::create(const std::string& directory, const std::string& terrain, const std::string& output, int tileWidth, int tileHeight) {
+	GEOTIFF_READER terrainReader(new GdalTiffReader(terrain));
+	RASTER_BAND terrainBand(terrainReader->getRasterBand(1));
+
+	if (!tileWidth || !tileHeight) {
+		tileWidth = tileHeight = 1024;
+	}
+
+	std::filesystem::create_directories(directory);
+
+	std::ofstream manifest(std::filesystem::path(directory) / "job.txt", std::ios::trunc);
+	manifest << "terrain=" << terrain << std::endl;
+	manifest << "output=" << output << std::endl;
+	manifest << "width=" << terrainBand->getXSize() << std::endl;
+	manifest << "height=" << terrainBand->getYSize() << std::endl;
+	manifest << "tileWidth=" << tileWidth << std::endl;
+	manifest << "tileHeight=" << tileHeight << std::endl;
+
+	if (!manifest) {
+		throw std::runtime_error("TileJob: Failed to write the job manifest!");
+	}
+}
+
+void TileJob::work(Stage stage, int worker, int workersCount, int threadsCount) {
+	std::vector<size_t> tiles;
+
+	// Accumulation tiles are laid out by TiledAccumulator, square whatever the layout of the joined directions is
+	std::unique_ptr<TiledAccumulator> accumulator;
+	GEOTIFF_READER reader;
+	RASTER_BAND band;
+
+	if (stage == Stage::Directions) {
+		reader.reset(new GdalTiffReader(terrain_));
+	}
+	else {
+		reader.reset(new GdalTiffReader(getPath("directions", NONE).string()));
+	}
+
+	band.reset(reader->getRasterBand(1));
+
+	if (stage != Stage::Directions) {
+		accumulator.reset(new TiledAccumulator(band, band, FlowCell::NO_DATA, tileWidth_, tileHeight_, budget_));
+	}
+
+	size_t tilesCount = accumulator ? accumulator->getTilesCount() : getTilesCount();
+
+	for (size_t tile = worker; tile < tilesCount; tile += workersCount) {
+		tiles.push_back(tile);
+	}
+
+	std::cout << "Worker " << worker << "/" << workersCount << ": " << tiles.size() << " of " << tilesCount << " tiles" << std::endl;
+
+	forEachTile(tiles, threadsCount, [this, stage, &band, &accumulator](size_t tile) {
+		switch (stage) {
+		case Stage::Directions:
+			computeDirections(tile, band);
+			break;
+		case Stage::Perimeters:
+			accumulator->accumulateFirstPass(tile);
+			accumulator->savePerimeter(tile, getPath("perimeter", tile).string());
+			break;
+		case Stage::Accumulation: {
+			std::vector<uint32_t> accumulation;
+
+			accumulator->loadIncoming(tile, getPath("incoming", tile).string());
+			accumulator->accumulateSecondPass(tile, accumulation);
+
+			writeFile(getPath("accumulation", tile), accumulation.data(), accumulation.size() * sizeof(uint32_t));
+			break;
+		}
+		}
+		});
+}
+
+void TileJob::runWorkers(const std::string& directory, Stage stage, int workersCount, int threadsCount, size_t workerBudget) {
+#ifdef _WIN32
+	wchar_t runner[MAX_PATH];
+
+	if (!GetModuleFileNameW(nullptr, runner, MAX_PATH)) {
+		throw std::runtime_error("TileJob: Failed to find the runner!");
+	}
+
+	std::string stageName = getStageName(stage);
+	std::vector<PROCESS_INFORMATION> workers;
+
+	auto quote = [](const std::wstring& argument) {
+		return L"\"" + argument + L"\" ";
+	};
+
+	for (int worker = 0; worker < workersCount; worker++) {
+		std::wstring commandLine = quote(runner) + L"job work " + quote(std::filesystem::path(directory).wstring());
+		commandLine += std::wstring(stageName.begin(), stageName.end()) + L" " + std::to_wstring(worker) + L" " + std::to_wstring(workersCount);
+		commandLine += L" --threads " + std::to_wstring(threadsCount) + L" --budget " + std::to_wstring(max(workerBudget / (1024 * 1024), size_t(1)));
+
+		STARTUPINFOW startupInfo{ sizeof(STARTUPINFOW) };
+		PROCESS_INFORMATION processInfo{};
+
+		if (!CreateProcessW(runner, commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo)) {
+			break;
+		}
+
+		workers.push_back(processInfo);
+	}
+
+	// Started ones are waited for even if a start failed, they share the job directory
+	int failed = workersCount - int(workers.size());
+
+	for (auto& worker : workers) {
+		DWORD exitCode = 1;
+
+		WaitForSingleObject(worker.hProcess, INFINITE);
+		GetExitCodeProcess(worker.hProcess, &exitCode);
+
+		failed += exitCode != 0;
+
+		CloseHandle(worker.hThread);
+		CloseHandle(worker.hProcess);
+	}
+
+	if (failed) {
+		throw std::runtime_error("TileJob: " + std::to_string(failed) + " of " + std::to_string(workersCount) + " " + stageName + " workers failed!");
+	}
+#else
+	std::error_code error;
+	std::string runner = std::filesystem::read_symlink("/proc/self/exe", error).string();
+
+	if (error) {
+		throw std::runtime_error("TileJob: Failed to find the runner!");
+	}
+
+	std::string stageName = getStageName(stage);
+	std::vector<pid_t> workers;
+
+	for (int worker = 0; worker < workersCount; worker++) {
+		std::vector<std::string> arguments = { runner, "job", "work", directory, stageName, std::to_string(worker), std::to_string(workersCount),
+			"--threads", std::to_string(threadsCount), "--budget", std::to_string(max(workerBudget / (1024 * 1024), size_t(1))) };
+		std::vector<char*> argv;
+
+		for (auto& argument : arguments) {
+			argv.push_back(argument.data());
+		}
+
+		argv.push_back(nullptr);
+		pid_t process;
+
+		if (posix_spawn(&process, runner.c_str(), nullptr, nullptr, argv.data(), environ)) {
+			break;
+		}
+
+		workers.push_back(process);
+	}
+
+	// Started ones are waited for even if a start failed, they share the job directory
+	int failed = workersCount - int(workers.size());
+
+	for (pid_t worker : workers) {
+		int status = -1; // Not exited if the wait fails
+
+		while (waitpid(worker, &status, 0) == -1 && errno == EINTR);
+
+		failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	}
+
+	if (failed) {
+		throw std::runtime_error("TileJob: " + std::to_string(failed) + " of " + std::to_string(workersCount) + " " + stageName + " workers failed!");
+	}
+#endif
+}
+
+const char* TileJob::getStageName(Stage stage) {
+	switch (stage) {
+	case Stage::Directions:
+		return "directions";
+	case Stage::Perimeters:
+		return "perimeters";
+	default:
+		return "accumulation";
+	}
+}
+
+void TileJob::merge(Stage stage, const CreationProfile& profile, int threadsCount) {
+	switch (stage) {
+	case Stage::Directions:
+		mergeDirections(threadsCount);
+		break;
+	case Stage::Perimeters:
+		mergePerimeters();
+		break;
+	case Stage::Accumulation:
+		mergeAccumulation(profile);
+		break;
+	}
+}
+
+std::filesystem::path TileJob::getPath(const std::string& name, size_t tile) {
+	return directory_ / (tile == NONE ? name + ".tif" : name + "_" + std::to_string(tile) + ".bin");
+}
+
+size_t TileJob::getTilesCount() {
+	return size_t((width_ + tileWidth_ - 1) / tileWidth_) * ((height_ + tileHeight_ - 1) / tileHeight_);
+}
+
+void TileJob::getTileRect(size_t tile, int* x, int* y, int* width, int* height) {
+	int tilesPerRow = (width_ + tileWidth_ - 1) / tileWidth_;
+
+	*x = int(tile % tilesPerRow) * tileWidth_;
+	*y = int(tile / tilesPerRow) * tileHeight_;
+	*width = min(tileWidth_, width_ - *x);
+	*height = min(tileHeight_, height_ - *y);
+}
+
+void TileJob::computeDirections(size_t tile, RASTER_BAND& terrainBand) {
+	int x, y, width, height;
+	getTileRect(tile, &x, &y, &width, &height);
+
+	// The tile with a halo cell around, NaN outside of the raster
+	int stride = width + 2;
+	int left = max(x - 1, 0), right = min(x + width + 1, width_);
+	int top = max(y - 1, 0), bottom = min(y + height + 1, height_);
+
+	std::vector<float> read(size_t(right - left) * (bottom - top));
+	std::vector<float> terrain(size_t(stride) * (height + 2), std::numeric_limits<float>::quiet_NaN());
+
+	if (terrainBand->rasterFloat(left, top, right - left, bottom - top, read.data(), right - left, bottom - top)) {
+		throw std::runtime_error("TileJob: Failed to read terrain!");
+	}
+
+	for (int row = 0; row < bottom - top; row++) {
+		std::copy_n(read.data() + size_t(row) * (right - left), right - left, terrain.data() + size_t(row + top - (y - 1)) * stride + left - (x - 1));
+	}
+
+	DirectionKernel kernel(stride, codes_, terrainBand->getNoDataValue(), FlowCell::NO_DATA);
+
+	std::vector<int8_t> directions(size_t(width) * height);
+	std::vector<FlatCell> flats;
+
+	for (int row = 0; row < height; row++) {
+		const float* terrainRow = terrain.data() + size_t(row + 1) * stride + 1;
+		int8_t* directionsRow = directions.data() + size_t(row) * width;
+
+		if (!kernel.computeRow(terrainRow, width, directionsRow, DirectionKernel::getEdges(x, y + row, width, width_, height_))) {
+			for (int column = 0; column < width; column++) {
+				if (!directionsRow[column]) {
+					flats.push_back({ x + column, y + row, FlatResolver::getEqualNeighbours(terrainRow + column, stride) });
+				}
+			}
+		}
+	}
+
+	writeFile(getPath("directions", tile), directions.data(), directions.size());
+	writeFile(getPath("flats", tile), flats.data(), flats.size() * sizeof(FlatCell));
+}
+
+void TileJob::mergeDirections(int threadsCount) {
+	GEOTIFF_READER terrainReader(new GdalTiffReader(terrain_));
+
+	GEOTIFF_READER directionsReader(new GdalTiffReader(getPath("directions", NONE).string(), width_, height_, 1));
+	directionsReader->setProjection(terrainReader->getProjection());
+	directionsReader->setGeoTransform(terrainReader->getGeoTransform());
+
+	RASTER_BAND directionsBand(directionsReader->getRasterBand(1));
+	directionsBand->setNoDataValue(FlowCell::NO_DATA);
+
+	std::vector<int8_t> directions;
+	std::vector<FlatCell> flats;
+	std::vector<FlatCell> tileFlats;
+
+	for (size_t tile = 0; tile < getTilesCount(); tile++) {
+		int x, y, width, height;
+		getTileRect(tile, &x, &y, &width, &height);
+
+		readFile(getPath("directions", tile), directions);
+
+		if (directions.size() != size_t(width) * height || directionsBand->raster(x, y, width, height, directions.data(), width, height)) {
+			throw std::runtime_error("TileJob: Failed to join directions!");
+		}
+
+		readFile(getPath("flats", tile), tileFlats);
+		flats.insert(flats.end(), tileFlats.begin(), tileFlats.end());
+
+		std::filesystem::remove(getPath("directions", tile));
+		std::filesystem::remove(getPath("flats", tile));
+	}
+
+	// Flats may span several tiles, they are resolved over the joined raster
+	std::sort(flats.begin(), flats.end(), [](const FlatCell& a, const FlatCell& b) {
+		return a.y < b.y || (a.y == b.y && a.x < b.x);
+		});
+
+	FlatResolver resolver(width_, height_, threadsCount, budget_);
+
+	for (auto& flat : flats) {
+		resolver.push(0, flat.x, flat.y, flat.equalNeighbours);
+	}
+
+	flats = std::vector<FlatCell>();
+
+	resolver.prepare();
+
+	{
+		std::shared_ptr<Canvas<uint8_t>> canvas(new Canvas<uint8_t>(directionsBand, true, budget_, 0, 0, false));
+
+		// Every thread has to take part, large flats are shared by all of them
+		std::exception_ptr failure;
+		std::mutex failureMutex;
+
+		std::vector<std::thread> threads;
+		threads.reserve(threadsCount);
+
+		for (int i = 0; i < threadsCount; i++) {
+			threads.emplace_back([this, &resolver, &canvas, &failure, &failureMutex, i]() {
+				try {
+					resolver.resolve(canvas, codes_, i);
+				}
+				catch (...) {
+					std::unique_lock lock(failureMutex);
+
+					if (!failure) {
+						failure = std::current_exception();
+					}
+				}
+				});
+		}
+
+		for (auto& thread : threads) {
+			thread.join();
+		}
+
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
+
+		canvas->flush();
+	}
+
+	std::cout << "Flat cells: " << resolver.size() << " in " << resolver.getFlatsCount() << " flats" << std::endl;
+}
+
+void TileJob::mergePerimeters() {
+	GEOTIFF_READER directionsReader(new GdalTiffReader(getPath("directions", NONE).string()));
+	RASTER_BAND directionsBand(directionsReader->getRasterBand(1));
+
+	TiledAccumulator accumulator(directionsBand, directionsBand, FlowCell::NO_DATA, tileWidth_, tileHeight_, budget_);
+
+	for (size_t tile = 0; tile < accumulator.getTilesCount(); tile++) {
+		accumulator.loadPerimeter(tile, getPath("perimeter", tile).string());
+	}
+
+	accumulator.solvePerimeters();
+
+	for (size_t tile = 0; tile < accumulator.getTilesCount(); tile++) {
+		accumulator.saveIncoming(tile, getPath("incoming", tile).string());
+
+		std::filesystem::remove(getPath("perimeter", tile));
+	}
+}
+
+void TileJob::mergeAccumulation(const CreationProfile& profile) {
+	GEOTIFF_READER terrainReader(new GdalTiffReader(terrain_));
+
+	GEOTIFF_READER directionsReader(new GdalTiffReader(getPath("directions", NONE).string()));
+	RASTER_BAND directionsBand(directionsReader->getRasterBand(1));
+
+	GEOTIFF_READER accumulationReader(new GdalTiffReader(output_, width_, height_, 1, RasterDataType::UInt32, profile));
+	accumulationReader->setProjection(terrainReader->getProjection());
+	accumulationReader->setGeoTransform(terrainReader->getGeoTransform());
+
+	RASTER_BAND accumulationBand(accumulationReader->getRasterBand(1));
+
+	TiledAccumulator accumulator(directionsBand, directionsBand, FlowCell::NO_DATA, tileWidth_, tileHeight_, budget_);
+
+	std::vector<uint32_t> accumulation;
+
+	for (size_t tile = 0; tile < accumulator.getTilesCount(); tile++) {
+		int x, y, width, height;
+		accumulator.getTileRect(tile, &x, &y, &width, &height);
+
+		readFile(getPath("accumulation", tile), accumulation);
+
+		if (accumulation.size() != size_t(width) * height || accumulationBand->raster(x, y, width, height, accumulation.data(), width, height)) {
+			throw std::runtime_error("TileJob: Failed to join accumulation!");
+		}
+
+		std::filesystem::remove(getPath("accumulation", tile));
+		std::filesystem::remove(getPath("incoming", tile));
+	}
+
+	// Same statistics as the outputs of process
+	accumulationBand->computeRasterMinMax();
+}
\ No newline at end of file
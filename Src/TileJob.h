@@ -0,0 +1,69 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "Canvas.h"
+
+// Directions and accumulation split into tile jobs for worker processes sharing the job directory, on one host or on
+// several ones mounting it. Every stage is run by all the workers, each taking the tiles of its index, then merged once
+// by the coordinator: directions are joined and their flats resolved, perimeters solved, accumulation tiles written out.
+class TileJob {
+public:
+	enum class Stage {
+		Directions = 1,
+		Perimeters = 2,
+		Accumulation = 3
+	};
+
+	// Opens the job created in directory
+	TileJob(const std::string& directory, MEMORY_BUDGET budget);
+
+	// Writes the manifest of a new job, tiles are 1024 x 1024 cells if zero
+	static void create(const std::string& directory, const std::string& terrain, const std::string& output, int tileWidth, int tileHeight);
+
+	void work(Stage stage, int worker, int workersCount, int threadsCount);
+	void merge(Stage stage, const CreationProfile& profile, int threadsCount);
+
+	// Starts the workers of the stage as processes of the running executable, which must be the console runner, and
+	// waits for all of them. Throws if any one fails.
+	static void runWorkers(const std::string& directory, Stage stage, int workersCount, int threadsCount, size_t workerBudget);
+
+	static const char* getStageName(Stage stage);
+
+private:
+	static constexpr size_t NONE = ~size_t(0); // Tile index of the joined rasters
+
+	struct FlatCell {
+		int x;
+		int y;
+		uint8_t equalNeighbours;
+	};
+
+	std::filesystem::path getPath(const std::string& name, size_t tile);
+
+	size_t getTilesCount();
+	void getTileRect(size_t tile, int* x, int* y, int* width, int* height);
+
+	void computeDirections(size_t tile, RASTER_BAND& terrainBand);
+
+	void mergeDirections(int threadsCount);
+	void mergePerimeters();
+	void mergeAccumulation(const CreationProfile& profile);
+
+	std::filesystem::path directory_;
+	MEMORY_BUDGET budget_;
+
+	std::string terrain_;
+	std::string output_;
+
+	int width_ = 0;
+	int height_ = 0;
+
+	int tileWidth_ = 0;
+	int tileHeight_ = 0;
+
+	int8_t codes_[8]{};
+};
\ No newline at end of file
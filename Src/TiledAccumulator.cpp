@@ -0,0 +1,467 @@
+#include "pch.h"
+
+#include "TiledAccumulator.h"
+
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "FlowCell.h"
+
+// Bytes per cell of a tile being accumulated, see Buffers
+static const size_t TILE_CELL_SIZE = sizeof(uint8_t) * 2 + sizeof(int) * 3 + sizeof(uint32_t);
+
+// Bytes per perimeter cell, the arrays kept between the passes and the ones of the solver
+static const size_t PERIMETER_CELL_SIZE = sizeof(uint8_t) * 2 + sizeof(uint32_t) * 3 + sizeof(int) + sizeof(size_t) * 2;
+
+// Perimeters of tiles this high take under 2% of their cells
+static const int MIN_TILE_SIDE = 256;
+
+// At most one cell of this many may be a perimeter one
+static const size_t MAX_PERIMETER_SHARE = 16;
+
+TiledAccumulator::TiledAccumulator(RASTER_BAND directions, RASTER_BAND output, int noDataDirection, int tileWidth, int tileHeight, MEMORY_BUDGET budget) : directions_(directions), output_(output), noDataDirection_(noDataDirection), budget_(budget) {
+	width_ = directions_->getXSize();
+	height_ = directions_->getYSize();
+
+	if (!tileWidth || !tileHeight) {
+		tileWidth = tileHeight = 1024;
+	}
+
+	// Square-ish tiles whatever the output layout is, full width strips a few rows high would make most of the cells
+	// perimeter ones. Output tiles are followed only when the blocks are tiles themselves.
+	tileWidth = max(tileWidth, MIN_TILE_SIDE);
+	tileHeight = max(tileHeight, MIN_TILE_SIDE);
+
+	int blockWidth, blockHeight;
+	output_->getBlockSize(&blockWidth, &blockHeight);
+
+	if (blockWidth < width_) {
+		tileWidth = (tileWidth + blockWidth - 1) / blockWidth * blockWidth;
+		tileHeight = (tileHeight + blockHeight - 1) / blockHeight * blockHeight;
+	}
+
+	tileWidth_ = min(tileWidth, width_);
+	tileHeight_ = min(tileHeight, height_);
+
+	tilesPerRow_ = (width_ + tileWidth_ - 1) / tileWidth_;
+
+	size_t perimeter = 0;
+
+	for (int y = 0; y < height_; y += tileHeight_) {
+		for (int x = 0; x < width_; x += tileWidth_) {
+			Tile tile{ x, y, min(tileWidth_, width_ - x), min(tileHeight_, height_ - y), perimeter };
+
+			tiles_.push_back(tile);
+			perimeter += getPerimeterSize(tile.width, tile.height);
+		}
+	}
+
+	// The graph is meant to be a small fraction of the raster, it is held in RAM as a whole
+	if (tiles_.size() > 1 && perimeter * MAX_PERIMETER_SHARE > size_t(width_) * height_) {
+		throw std::runtime_error("FlowAccumulation: Tile perimeters are too large for " + std::to_string(tileWidth_) + "x" + std::to_string(tileHeight_) + " tiles!");
+	}
+
+	perimeterDirections_.resize(perimeter);
+	local_.resize(perimeter);
+	exits_.resize(perimeter);
+	incoming_.resize(perimeter);
+}
+
+void TiledAccumulator::accumulate(int threadsCount) {
+	size_t perimeterCells = tiles_.back().perimeter + getPerimeterSize(tiles_.back().width, tiles_.back().height);
+	size_t workingSize = size_t(tileWidth_) * tileHeight_ * TILE_CELL_SIZE * threadsCount + perimeterCells * PERIMETER_CELL_SIZE;
+
+	budget_->acquire(workingSize, true);
+
+	std::cout << "Accumulation tiles: " << tiles_.size() << " of " << tileWidth_ << "x" << tileHeight_ << ", " << perimeterCells << " perimeter cells" << std::endl;
+
+	processed_ = 0;
+
+	try {
+		forEachTile(threadsCount, [this](Tile& tile, Buffers& buffers) {
+			accumulateTile(tile, buffers, nullptr);
+			collectPerimeter(tile, buffers);
+			});
+
+		solvePerimeters();
+
+		forEachTile(threadsCount, [this](Tile& tile, Buffers& buffers) {
+			accumulateTile(tile, buffers, incoming_.data() + tile.perimeter);
+
+			if (output_->raster(tile.x, tile.y, tile.width, tile.height, buffers.accumulation.data(), tile.width, tile.height)) {
+				throw std::runtime_error("FlowAccumulation: Failed to write accumulation!");
+			}
+			});
+	}
+	catch (...) {
+		budget_->release(workingSize);
+
+		throw;
+	}
+
+	perimeterDirections_ = std::vector<uint8_t>();
+	local_ = std::vector<uint32_t>();
+	exits_ = std::vector<int>();
+	incoming_ = std::vector<uint32_t>();
+
+	budget_->release(workingSize);
+}
+
+size_t TiledAccumulator::getTilesCount() {
+	return tiles_.size();
+}
+
+void TiledAccumulator::accumulateFirstPass(size_t tile) {
+	Buffers buffers;
+
+	accumulateTile(tiles_[tile], buffers, nullptr);
+	collectPerimeter(tiles_[tile], buffers);
+}
+
+void TiledAccumulator::accumulateSecondPass(size_t tile, std::vector<uint32_t>& accumulation) {
+	Buffers buffers;
+
+	accumulateTile(tiles_[tile], buffers, incoming_.data() + tiles_[tile].perimeter);
+
+	accumulation.swap(buffers.accumulation);
+}
+
+void TiledAccumulator::savePerimeter(size_t tile, const std::string& fileName) {
+	size_t offset = tiles_[tile].perimeter;
+	size_t count = getPerimeterSize(tiles_[tile].width, tiles_[tile].height);
+
+	writeFile(fileName, { { &perimeterDirections_[offset], count * sizeof(uint8_t) }, { &local_[offset], count * sizeof(uint32_t) }, { &exits_[offset], count * sizeof(int) } });
+}
+
+void TiledAccumulator::loadPerimeter(size_t tile, const std::string& fileName) {
+	size_t offset = tiles_[tile].perimeter;
+	size_t count = getPerimeterSize(tiles_[tile].width, tiles_[tile].height);
+
+	readFile(fileName, { { &perimeterDirections_[offset], count * sizeof(uint8_t) }, { &local_[offset], count * sizeof(uint32_t) }, { &exits_[offset], count * sizeof(int) } });
+}
+
+void TiledAccumulator::saveIncoming(size_t tile, const std::string& fileName) {
+	size_t count = getPerimeterSize(tiles_[tile].width, tiles_[tile].height);
+
+	writeFile(fileName, { { &incoming_[tiles_[tile].perimeter], count * sizeof(uint32_t) } });
+}
+
+void TiledAccumulator::loadIncoming(size_t tile, const std::string& fileName) {
+	size_t count = getPerimeterSize(tiles_[tile].width, tiles_[tile].height);
+
+	readFile(fileName, { { &incoming_[tiles_[tile].perimeter], count * sizeof(uint32_t) } });
+}
+
+void TiledAccumulator::getTileRect(size_t tile, int* x, int* y, int* width, int* height) {
+	*x = tiles_[tile].x;
+	*y = tiles_[tile].y;
+	*width = tiles_[tile].width;
+	*height = tiles_[tile].height;
+}
+
+void TiledAccumulator::writeFile(const std::string& fileName, const std::vector<std::pair<const void*, size_t>>& parts) {
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+
+	for (auto& [data, size] : parts) {
+		file.write((const char*)data, size);
+	}
+
+	if (!file) {
+		throw std::runtime_error("FlowAccumulation: Failed to write " + fileName + "!");
+	}
+}
+
+void TiledAccumulator::readFile(const std::string& fileName, const std::vector<std::pair<void*, size_t>>& parts) {
+	std::ifstream file(fileName, std::ios::binary);
+
+	for (auto& [data, size] : parts) {
+		file.read((char*)data, size);
+	}
+
+	if (!file) {
+		throw std::runtime_error("FlowAccumulation: Failed to read " + fileName + "!");
+	}
+}
+
+int TiledAccumulator::getTileWidth() {
+	return tileWidth_;
+}
+
+int TiledAccumulator::getTileHeight() {
+	return tileHeight_;
+}
+
+int TiledAccumulator::getProgress() {
+	return tiles_.empty() ? 0 : int(processed_.load() * 100 / (tiles_.size() * 2));
+}
+
+int TiledAccumulator::getPerimeterSize(int width, int height) {
+	if (width == 1 || height <= 2) {
+		return width * height;
+	}
+
+	return 2 * width + 2 * (height - 2);
+}
+
+int TiledAccumulator::getPerimeterIndex(const Tile& tile, int x, int y) {
+	// Top row, bottom row, then the inner cells of the left and the right columns
+	if (tile.width == 1 || tile.height <= 2) {
+		return y * tile.width + x;
+	}
+
+	if (y == 0) {
+		return x;
+	}
+
+	if (y == tile.height - 1) {
+		return tile.width + x;
+	}
+
+	if (x == 0) {
+		return 2 * tile.width + y - 1;
+	}
+
+	if (x == tile.width - 1) {
+		return 2 * tile.width + tile.height - 2 + y - 1;
+	}
+
+	return -1;
+}
+
+TiledAccumulator::Tile& TiledAccumulator::getTile(int x, int y) {
+	return tiles_[size_t(y / tileHeight_) * tilesPerRow_ + x / tileWidth_];
+}
+
+void TiledAccumulator::forEachTile(int threadsCount, const std::function<void(Tile&, Buffers&)>& body) {
+	std::atomic<size_t> nextTile{ 0 };
+	std::exception_ptr failure;
+	std::mutex failureMutex;
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadsCount);
+
+	for (int i = 0; i < threadsCount; i++) {
+		threads.emplace_back([this, &body, &nextTile, &failure, &failureMutex]() {
+			Buffers buffers;
+
+			try {
+				for (size_t tile = nextTile++; tile < tiles_.size(); tile = nextTile++) {
+					body(tiles_[tile], buffers);
+
+					processed_++;
+				}
+			}
+			catch (...) {
+				std::unique_lock lock(failureMutex);
+
+				if (!failure) {
+					failure = std::current_exception();
+				}
+
+				nextTile = tiles_.size();
+			}
+			});
+	}
+
+	for (auto& thread : threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	if (failure) {
+		std::rethrow_exception(failure);
+	}
+}
+
+void TiledAccumulator::accumulateTile(const Tile& tile, Buffers& buffers, const uint32_t* incoming) {
+	int width = tile.width;
+	int height = tile.height;
+	size_t cells = size_t(width) * height;
+
+	buffers.directions.resize(cells);
+
+	if (directions_->rasterByte(tile.x, tile.y, width, height, buffers.directions.data(), width, height)) {
+		throw std::runtime_error("FlowAccumulation: Failed to read directions!");
+	}
+
+	buffers.downstream.resize(cells);
+	buffers.inDegrees.assign(cells, 0);
+	buffers.accumulation.resize(cells);
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t c = size_t(y) * width + x;
+			int direction = FlowCell::getDirection(buffers.directions[c]);
+
+			if (direction == noDataDirection_) {
+				buffers.downstream[c] = ENDS;
+				buffers.accumulation[c] = 0;
+
+				continue;
+			}
+
+			buffers.accumulation[c] = 1;
+
+			int nx = x + (direction - 1) % 3 - 1;
+			int ny = y + (direction - 1) / 3 - 1;
+
+			if (!direction || tile.x + nx < 0 || tile.x + nx >= width_ || tile.y + ny < 0 || tile.y + ny >= height_) {
+				buffers.downstream[c] = ENDS;
+			}
+			else if (nx < 0 || nx >= width || ny < 0 || ny >= height) {
+				buffers.downstream[c] = LEAVES;
+			}
+			else {
+				int n = ny * width + nx;
+
+				if (FlowCell::getDirection(buffers.directions[n]) == noDataDirection_) {
+					buffers.downstream[c] = ENDS;
+				}
+				else {
+					buffers.downstream[c] = n;
+					buffers.inDegrees[n]++;
+				}
+			}
+		}
+	}
+
+	if (incoming) {
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x += (y == 0 || y == height - 1) ? 1 : max(width - 1, 1)) {
+				size_t c = size_t(y) * width + x;
+
+				if (buffers.accumulation[c]) {
+					buffers.accumulation[c] += incoming[getPerimeterIndex(tile, x, y)];
+				}
+			}
+		}
+	}
+
+	// Kahn's ordering within the tile, order doubles as the queue
+	buffers.order.clear();
+
+	for (size_t c = 0; c < cells; c++) {
+		if (buffers.accumulation[c] && !buffers.inDegrees[c]) {
+			buffers.order.push_back(int(c));
+		}
+	}
+
+	for (size_t k = 0; k < buffers.order.size(); k++) {
+		int c = buffers.order[k];
+		int n = buffers.downstream[c];
+
+		if (n < 0) {
+			continue;
+		}
+
+		buffers.accumulation[n] += buffers.accumulation[c];
+
+		if (!--buffers.inDegrees[n]) {
+			buffers.order.push_back(n);
+		}
+	}
+}
+
+void TiledAccumulator::collectPerimeter(const Tile& tile, Buffers& buffers) {
+	int width = tile.width;
+	int height = tile.height;
+
+	// Downstream cells come later in the order, so their exits are known first going backwards
+	buffers.exits.assign(size_t(width) * height, ENDS);
+
+	for (size_t k = buffers.order.size(); k-- > 0;) {
+		int c = buffers.order[k];
+		int n = buffers.downstream[c];
+
+		if (n == LEAVES) {
+			buffers.exits[c] = getPerimeterIndex(tile, c % width, c / width);
+		}
+		else if (n >= 0) {
+			buffers.exits[c] = buffers.exits[n];
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x += (y == 0 || y == height - 1) ? 1 : max(width - 1, 1)) {
+			size_t c = size_t(y) * width + x;
+			size_t q = tile.perimeter + getPerimeterIndex(tile, x, y);
+
+			perimeterDirections_[q] = uint8_t(FlowCell::getDirection(buffers.directions[c]));
+			local_[q] = buffers.accumulation[c];
+			exits_[q] = buffers.exits[c];
+		}
+	}
+}
+
+void TiledAccumulator::solvePerimeters() {
+	static const size_t NONE = ~size_t(0);
+
+	size_t count = local_.size();
+
+	// Every outflow drains into a perimeter cell of the neighbouring tile, thus into one of its outflows or nowhere
+	std::vector<size_t> targets(count, NONE);
+	std::vector<size_t> successors(count, NONE);
+	std::vector<uint32_t> inDegrees(count, 0); // A river exit can collect the outflows of a whole tile edge
+
+	for (auto& tile : tiles_) {
+		for (int y = 0; y < tile.height; y++) {
+			for (int x = 0; x < tile.width; x += (y == 0 || y == tile.height - 1) ? 1 : max(tile.width - 1, 1)) {
+				int p = getPerimeterIndex(tile, x, y);
+				size_t q = tile.perimeter + p;
+
+				if (exits_[q] != p) {
+					continue;
+				}
+
+				int direction = perimeterDirections_[q];
+				int tx = tile.x + x + (direction - 1) % 3 - 1;
+				int ty = tile.y + y + (direction - 1) / 3 - 1;
+
+				Tile& targetTile = getTile(tx, ty);
+				size_t target = targetTile.perimeter + getPerimeterIndex(targetTile, tx - targetTile.x, ty - targetTile.y);
+
+				if (perimeterDirections_[target] == noDataDirection_) {
+					continue;
+				}
+
+				targets[q] = target;
+
+				if (exits_[target] >= 0) {
+					successors[q] = targetTile.perimeter + exits_[target];
+					inDegrees[successors[q]]++;
+				}
+			}
+		}
+	}
+
+	// Totals of the outflows in topological order over the graph
+	std::vector<uint32_t> totals(local_);
+	std::vector<size_t> ready;
+
+	for (size_t q = 0; q < count; q++) {
+		if (targets[q] != NONE && !inDegrees[q]) {
+			ready.push_back(q);
+		}
+	}
+
+	incoming_.assign(count, 0);
+
+	while (!ready.empty()) {
+		size_t q = ready.back();
+		ready.pop_back();
+
+		incoming_[targets[q]] += totals[q];
+
+		size_t successor = successors[q];
+
+		if (successor != NONE) {
+			totals[successor] += totals[q];
+
+			if (!--inDegrees[successor] && targets[successor] != NONE) {
+				ready.push_back(successor);
+			}
+		}
+	}
+}
\ No newline at end of file
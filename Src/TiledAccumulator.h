@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Canvas.h"
+
+// Flow accumulation in two passes over the tiles (Barnes 2017). The first pass accumulates every tile alone and keeps
+// just its perimeter: local sums of the cells leaving the tile and the outflow each perimeter cell drains to. The graph
+// of the perimeters is solved for the sums flowing into every tile, the second pass accumulates again adding them.
+class TiledAccumulator {
+public:
+	// Tiles of at least 256 x 256 cells, 1024 x 1024 if zero, made of whole blocks when the output is tiled
+	TiledAccumulator(RASTER_BAND directions, RASTER_BAND output, int noDataDirection, int tileWidth, int tileHeight, MEMORY_BUDGET budget);
+
+	void accumulate(int threadsCount);
+
+	// Single passes over the tiles spread among processes, the perimeters travel between them through files
+	size_t getTilesCount();
+	void accumulateFirstPass(size_t tile);
+	void accumulateSecondPass(size_t tile, std::vector<uint32_t>& accumulation);
+	void solvePerimeters();
+
+	void savePerimeter(size_t tile, const std::string& fileName);
+	void loadPerimeter(size_t tile, const std::string& fileName);
+	void saveIncoming(size_t tile, const std::string& fileName);
+	void loadIncoming(size_t tile, const std::string& fileName);
+
+	// Position and size of the tile in the raster
+	void getTileRect(size_t tile, int* x, int* y, int* width, int* height);
+
+	int getTileWidth();
+	int getTileHeight();
+
+	// Tiles processed by both passes, 0..100
+	int getProgress();
+
+private:
+	static constexpr int LEAVES = -1;
+	static constexpr int ENDS = -2;
+
+	struct Tile {
+		int x;
+		int y;
+		int width;
+		int height;
+		size_t perimeter; // First cell in the perimeter arrays
+	};
+
+	// Working set of a thread, reused from tile to tile
+	struct Buffers {
+		std::vector<uint8_t> directions;
+		std::vector<int> downstream;
+		std::vector<uint8_t> inDegrees;
+		std::vector<int> order;
+		std::vector<uint32_t> accumulation;
+		std::vector<int> exits;
+	};
+
+	static int getPerimeterSize(int width, int height);
+	static int getPerimeterIndex(const Tile& tile, int x, int y);
+
+	Tile& getTile(int x, int y);
+
+	void forEachTile(int threadsCount, const std::function<void(Tile&, Buffers&)>& body);
+
+	// Accumulates the cells of the tile in topological order, incoming sums are added at the perimeter if given
+	void accumulateTile(const Tile& tile, Buffers& buffers, const uint32_t* incoming);
+	void collectPerimeter(const Tile& tile, Buffers& buffers);
+
+	static void writeFile(const std::string& fileName, const std::vector<std::pair<const void*, size_t>>& parts);
+	static void readFile(const std::string& fileName, const std::vector<std::pair<void*, size_t>>& parts);
+
+	RASTER_BAND directions_;
+	RASTER_BAND output_;
+	int noDataDirection_ = 0;
+	MEMORY_BUDGET budget_;
+
+	int width_ = 0;
+	int height_ = 0;
+
+	int tileWidth_ = 0;
+	int tileHeight_ = 0;
+	int tilesPerRow_ = 0;
+
+	std::vector<Tile> tiles_;
+
+	// Perimeter cells of all tiles
+	std::vector<uint8_t> perimeterDirections_;
+	std::vector<uint32_t> local_;
+	std::vector<int> exits_; // Perimeter index of the outflow the cell drains to within its tile, ENDS if none
+	std::vector<uint32_t> incoming_;
+
+	std::atomic_int processed_{ 0 };
+};
\ No newline at end of file
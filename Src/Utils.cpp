@@ -6,7 +6,7 @@ EXPORT_API int GetMaxThreadsCount() {
     return std::thread::hardware_concurrency();
 }
 
-EXPORT_API void Open(LPCSTR fileName) {
+EXPORT_API void Open(const char* fileName) {
     //GDALAllRegister();
     //
     ////  
@@ -1,6 +1,34 @@
 #pragma once
 
+#ifdef _WIN32
 #include <Windows.h>
 #include <iostream>
 
-#define EXPORT_API extern "C" __declspec(dllexport)
\ No newline at end of file
+#define EXPORT_API extern "C" __declspec(dllexport)
+#else
+// The console runner of the Linux build servers, linked statically with the sources
+#include <algorithm>
+#include <cstdint>
+#include <immintrin.h>
+#include <iostream>
+
+#define EXPORT_API extern "C" __attribute__((visibility("default")))
+
+using std::min;
+using std::max;
+
+typedef int LONG;
+typedef long long LONG64;
+
+inline char _InterlockedExchangeAdd8(volatile char* addend, char value) {
+	return __atomic_fetch_add(addend, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG _InterlockedExchangeAdd(volatile LONG* addend, LONG value) {
+	return __atomic_fetch_add(addend, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 _InterlockedExchangeAdd64(volatile LONG64* addend, LONG64 value) {
+	return __atomic_fetch_add(addend, value, __ATOMIC_SEQ_CST);
+}
+#endif